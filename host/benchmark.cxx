@@ -0,0 +1,1142 @@
+#include "plotHelper.h"
+#include "HoughHelper.h"
+#include "EventFormat.h"
+#include "MergeParser.h"
+#include "EventStore.h"
+#include "SampleGenerator.h"
+#include "ThreadPool.h"
+#include "EventBatch.h"
+#include "Dispatcher.h"
+#include "HoughEngine.h"
+#include "../kernel/kernel.h"
+#include "../kernel/hough_kernel.h"
+#include <getopt.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Throughput benchmarks, one subcommand per stage:
+//   ./benchmark parse   --data txtfiles/merge.txt [--scale N] [--threads N]
+//   ./benchmark threads --data txtfiles/merge.txt [--threads N] [--events N] [--pileup N] [--batch N]
+//   ./benchmark intra   --data txtfiles/merge.txt [--threads N] [--events N] [--pileup N] [--latency us]
+//   ./benchmark rows    --data txtfiles/merge.txt [--events N] [--pileup N]
+//   ./benchmark fill    --data txtfiles/merge.txt [--events N] [--pileup N]
+//   ./benchmark peaks   --data txtfiles/merge.txt [--events N] [--pileup N]
+//   ./benchmark doublets --data txtfiles/merge.txt [--events N] [--pileup N]
+//   ./benchmark select  --data txtfiles/merge.txt [--events N] [--pileup N] [--batch N] [--z0window mm] [--deta w]
+//   ./benchmark kernel  --data txtfiles/merge.txt [--events N] [--pileup N] [--batch N] [--z0window mm] [--deta w]
+//   ./benchmark dispatch --data txtfiles/merge.txt [--cu N] [--skew f] [--batch N]
+//   ./benchmark engine  --data txtfiles/merge.txt [--events N] [--pileup N] [--engine name]
+//   ./benchmark precision --data txtfiles/merge.txt [--events N] [--pileup N] [--engine name]
+//   ./benchmark coarse  --data txtfiles/merge.txt [--events N] [--pileup N] [--coarse N]
+//   ./benchmark sectors --data txtfiles/merge.txt [--events N] [--pileup N] [--threads N] [--sectors N] [--overlap rad]
+//   ./benchmark rz      --data txtfiles/merge.txt [--events N] [--pileup N] [--z0window mm] [--deta w]
+
+struct BenchOptions {
+  std::string file;
+  std::string outFile;
+  int scale;
+  unsigned nthreads;
+  size_t nevents;   // size of the synthetic samples
+  unsigned pileup;  // seed events overlaid in one synthetic event
+  size_t batch;     // events per scheduled task
+  double latency;   // per-event latency target [us]
+  unsigned ncu;     // compute units of the fake device
+  double skew;      // CU c of the fake device is (1 + c*skew) times slower
+  std::string engine; // compiled-in HoughEngine, empty for all of them
+  int coarse;         // coarse grid of the coarse-to-fine search, 0 for 27x27, 54x54 and 108x108
+  int sectors;        // phi sectors, 0 for 4, 8 and 16
+  double overlap;     // phi overlap of the sectors [rad], < 0 for the HoughConfig default
+  float z0Window;     // r-z pre-filter of the doublets [mm], 0 for none (rz: 0 for both windows scans a few)
+  float detaWindow;
+  BenchOptions() : file("txtfiles/merge.txt"), outFile("bench_merge.txt"), scale(200), nthreads(DefaultThreads()),
+                   nevents(2000), pileup(10), batch(16), latency(0), ncu(4), skew(0.5), coarse(0), sectors(0), overlap(-1),
+                   z0Window(0), detaWindow(0) {}
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Writes `scale` copies of a merged text file with shifted event numbers, returns the number of events
+static size_t writeScaledText(const string& inFile, const string& outFile, int scale) {
+  std::ifstream in(inFile.c_str());
+  std::vector<std::string> lines;
+  std::vector<int> events;
+  std::string line;
+  int nevents = 0;
+  while (std::getline(in, line)) {
+    int event;
+    std::stringstream ss(line);
+    if (!(ss >> event)) continue;
+    lines.push_back(line.substr(line.find_first_of(" \t")));
+    events.push_back(event);
+    nevents = std::max(nevents, event+1);
+  }
+  std::ofstream out(outFile.c_str());
+  for (int copy = 0; copy < scale; ++copy) {
+    for (size_t i = 0; i < lines.size(); ++i) out << events[i] + copy*nevents << lines[i] << "\n";
+  }
+  return size_t(nevents) * scale;
+}
+
+// The getline/stringstream reader that GetInfoFromFile used before the event store
+static void legacyGetInfoFromFile(const string& mergeFile, std::vector<std::vector<float>>& vec) {
+  int event;
+  double layer, r, x, y, z, charge, pt, d0, numhits;
+  std::string line;
+  std::ifstream MergeNameFile(mergeFile.c_str());
+  while (std::getline(MergeNameFile, line)){
+    std::stringstream ss(line);
+    ss >> event >> layer >> r >> x >> y >> z >> charge >> pt >> d0 >> numhits;
+    if (event >= (int) vec.size()) vec.resize(event+1);
+    vec[event].push_back(numhits);
+    vec[event].push_back(layer);
+    vec[event].push_back(r);
+    vec[event].push_back(x);
+    vec[event].push_back(y);
+    vec[event].push_back(z);
+    vec[event].push_back(charge);
+    vec[event].push_back(pt);
+    vec[event].push_back(d0);
+  }
+}
+
+// the per-event vectors of the getline reader (numhits, layer, r, x, y, z, charge, pt, d0 per hit) against
+// the columns, the truth of an event being the one of its first hit
+static bool sameAsLegacy(const std::vector<std::vector<float>>& vec, const EventColumns& cols) {
+  if (vec.size() != cols.nEvents()) return false;
+  for (size_t e = 0; e < vec.size(); ++e) {
+    const size_t first = cols.offsets[e], n = cols.offsets[e+1] - first;
+    if (vec[e].size() != 9*n) return false;
+    for (size_t k = 0; k < n; ++k) {
+      const float* h = &vec[e][9*k];
+      if (h[1] != cols.layer[first+k] || h[2] != cols.r[first+k] || h[3] != cols.x[first+k] || h[4] != cols.y[first+k] || h[5] != cols.z[first+k]) return false;
+    }
+    if (n > 0 && (vec[e][6] != cols.charge[e] || vec[e][7] != cols.pt[e] || vec[e][8] != cols.d0[e])) return false;
+  }
+  return true;
+}
+
+static bool sameColumns(const EventColumns& a, const EventColumns& b) {
+  return a.offsets == b.offsets && a.layer == b.layer && a.r == b.r && a.x == b.x && a.y == b.y && a.z == b.z &&
+         a.charge == b.charge && a.pt == b.pt && a.d0 == b.d0;
+}
+
+// ================================================
+// Text ingest: getline reader against ParseMergeText
+static int benchParse(const BenchOptions& opts) {
+  const size_t nevents = writeScaledText(opts.file, opts.outFile, opts.scale);
+  std::ifstream sizeCheck(opts.outFile.c_str(), std::ifstream::binary | std::ifstream::ate);
+  const double megabytes = double(sizeCheck.tellg()) / 1e6;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<std::vector<float>> datavec(nevents);
+  legacyGetInfoFromFile(opts.outFile, datavec);
+  const double legacy = secondsSince(start);
+
+  EventColumns serial, parallel;
+  start = std::chrono::steady_clock::now();
+  ParseMergeText(opts.outFile, serial, 1);
+  const double oneThread = secondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  ParseMergeText(opts.outFile, parallel, opts.nthreads);
+  const double nThreads = secondsSince(start);
+  std::remove(opts.outFile.c_str());
+
+  const double hits = serial.nHits();
+  printf(" sample: %.1f MB, %zu events, %.0f hits\n", megabytes, nevents, hits);
+  printf(" %-28s %8s %10s %12s\n", "reader", "time[s]", "MB/s", "Mhits/s");
+  printf(" %-28s %8.3f %10.1f %12.2f\n", "getline + stringstream", legacy, megabytes/legacy, hits/legacy/1e6);
+  printf(" %-28s %8.3f %10.1f %12.2f\n", "ParseMergeText 1 thread", oneThread, megabytes/oneThread, hits/oneThread/1e6);
+  char label[64];
+  snprintf(label, sizeof(label), "ParseMergeText %u threads", opts.nthreads);
+  printf(" %-28s %8.3f %10.1f %12.2f\n", label, nThreads, megabytes/nThreads, hits/nThreads/1e6);
+  const bool sameLegacy = sameAsLegacy(datavec, serial), sameParallel = sameColumns(serial, parallel);
+  printf(" serial result %s the getline reader\n", sameLegacy ? "matches" : "DIFFERS from");
+  printf(" parallel result %s the serial one\n", sameParallel ? "matches" : "DIFFERS from");
+  return sameLegacy && sameParallel ? 0 : 1;
+}
+
+static bool sameRoads(const std::vector<Road>& a, const std::vector<Road>& b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].event != b[i].event || a[i].x != b[i].x || a[i].y != b[i].y || a[i].count != b[i].count || a[i].hits != b[i].hits) return false;
+  }
+  return true;
+}
+
+// thread counts 1, 2, 4, ... up to and including maxThreads
+static std::vector<unsigned> threadSteps(unsigned maxThreads) {
+  std::vector<unsigned> steps;
+  for (unsigned t = 1; t < maxThreads; t *= 2) steps.push_back(t);
+  steps.push_back(std::max(1u, maxThreads));
+  return steps;
+}
+
+// ================================================
+// Event-parallel Hough: scaling of ProcessEvents on the work-stealing pool; false if any thread count
+// found other roads than the serial run
+static bool scaleEvents(const std::string& label, const EventStore& store, const BenchOptions& opts) {
+  HoughConfig config;
+  std::vector<Road> reference;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ProcessEvents(store, config, reference);
+  const double serial = secondsSince(start);
+
+  printf(" %s: %zu events, %zu hits, %zu roads\n", label.c_str(), store.nEvents(), store.nHits(), reference.size());
+  printf(" %8s %10s %12s %9s %s\n", "threads", "time[s]", "events/s", "speedup", "roads");
+  printf(" %8s %10.3f %12.1f %9.2f %s\n", "serial", serial, store.nEvents()/serial, 1.0, "reference");
+  bool identical = true;
+  std::vector<unsigned> steps = threadSteps(opts.nthreads);
+  for (size_t k = 0; k < steps.size(); ++k) {
+    ThreadPool pool(steps[k]);
+    std::vector<Road> roads;
+    start = std::chrono::steady_clock::now();
+    ProcessEvents(store, config, pool, opts.batch, roads);
+    const double time = secondsSince(start);
+    const bool same = sameRoads(reference, roads);
+    identical = identical && same;
+    printf(" %8u %10.3f %12.1f %9.2f %s\n", steps[k], time, store.nEvents()/time, serial/time, same ? "identical" : "DIFFERENT");
+  }
+  return identical;
+}
+
+static int benchThreads(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  bool identical = scaleEvents("bundled sample", sample, opts);
+  identical = scaleEvents("synthetic, pileup 1", MakeSyntheticSample(sample, opts.nevents, 1, 1), opts) && identical;
+  identical = scaleEvents("synthetic, pileup " + std::to_string(opts.pileup), MakeSyntheticSample(sample, opts.nevents/opts.pileup, opts.pileup, 2), opts) && identical;
+  return identical ? 0 : 1;
+}
+
+static bool sameImage(HoughImage& a, HoughImage& b, const HoughConfig& config) {
+  for (int x = 0; x < config.m_imageSize_x; ++x) {
+    for (int y = 0; y < config.m_imageSize_y; ++y) {
+      if (a(x, y) != b(x, y)) return false;
+    }
+  }
+  return true;
+}
+
+// ================================================
+// Intra-event parallel fill: per-event latency of high-pileup events against the serial fill
+static int benchIntra(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  EventStore events = MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/100), opts.pileup, 3);
+  HoughConfig config;
+  config.m_latencyTarget_us = opts.latency;
+
+  HoughImage serialImage(config.m_imageSize_x, config.m_imageSize_y), image(config.m_imageSize_x, config.m_imageSize_y);
+  std::vector<HoughImage> slices;
+  ThreadPool pool(opts.nthreads);
+
+  double pairs = 0, serialTime = 0;
+  for (size_t e = 0; e < events.nEvents(); ++e) {
+    serialImage.fill();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    FillImage(events, e, config, serialImage);
+    serialTime += secondsSince(start);
+    pairs += 0.5 * events.nHits(e) * (events.nHits(e) - 1);
+  }
+  printf(" %zu events, pileup %u, %.0f hits/event, serial fill %.1f us/event, %.1f ns per candidate pair\n", events.nEvents(), opts.pileup,
+         double(events.nHits())/events.nEvents(), 1e6*serialTime/events.nEvents(), 1e9*serialTime/pairs);
+  config.m_pairCost_ns = 1e9*serialTime/pairs; // calibrated on this machine
+  if (opts.latency > 0) printf(" latency target %.0f us -> %u slices per event\n", opts.latency, IntraEventSlices(events.nHits()/events.nEvents(), config, pool.size()));
+
+  printf(" %8s %14s %9s %s\n", "slices", "latency[us]", "speedup", "accumulator");
+  bool identical = true;
+  std::vector<unsigned> steps = threadSteps(opts.nthreads);
+  for (size_t k = 0; k < steps.size(); ++k) {
+    double time = 0;
+    bool same = true;
+    for (size_t e = 0; e < events.nEvents(); ++e) {
+      serialImage.fill();
+      FillImage(events, e, config, serialImage);
+      image.fill();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      FillImageParallel(events, e, config, pool, steps[k], slices, image);
+      time += secondsSince(start);
+      same = same && sameImage(serialImage, image, config);
+    }
+    identical = identical && same;
+    printf(" %8u %14.1f %9.2f %s\n", steps[k], 1e6*time/events.nEvents(), serialTime/time, same ? "bit-identical" : "DIFFERENT");
+  }
+  return identical ? 0 : 1;
+}
+
+// every doublet passing the pair selection, found with the (i, j) all-pairs loop that MakeDoublets replaced
+static void allPairsDoublets(const EventStore& store, size_t event, const HoughConfig& config, std::vector<Doublet>& doublets) {
+  for (size_t i = store.begin(event); i < store.end(event); ++i) {
+    for (size_t j = i+1; j < store.end(event); ++j) {
+      const double dr = GetR(store.x()[j], store.y()[j]) - GetR(store.x()[i], store.y()[i]);
+      if (store.layer()[i] == store.layer()[j]) continue;
+      if (!(config.m_acceptedDistanceBetweenLayersMin < dr && dr < config.m_acceptedDistanceBetweenLayersMax)) continue;
+      const pvec p1 {{store.x()[i], store.y()[i]}};
+      const pvec p2 {{store.x()[j], store.y()[j]}};
+      doublets.push_back(MakeDoublet(p1, p2, i, j));
+    }
+  }
+}
+
+static std::vector<Doublet> collectDoublets(const EventStore& store, const HoughConfig& config) {
+  std::vector<Doublet> doublets;
+  for (size_t e = 0; e < store.nEvents(); ++e) allPairsDoublets(store, e, config, doublets);
+  return doublets;
+}
+
+// ns per doublet of DoubletBins for one configuration, the bins of every doublet are appended to bins
+static double timeDoubletBins(const std::vector<Doublet>& doublets, const HoughConfig& config, std::vector<int>& bins) {
+  const size_t rows = config.m_imageSize_y;
+  bins.assign(doublets.size() * rows, 0);
+  int repeat = 1;
+  double time = 0;
+  while (true) { // repeat until the measurement takes at least 0.2 s
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; ++r) {
+      for (size_t d = 0; d < doublets.size(); ++d) DoubletBins(doublets[d], config, &bins[d*rows]);
+    }
+    time = secondsSince(start);
+    if (time > 0.2) break;
+    repeat *= 2;
+  }
+  return 1e9 * time / (double(repeat) * doublets.size());
+}
+
+// rows where two bin lists differ, and doublets with at least one such row
+static void countMismatches(const std::vector<int>& a, const std::vector<int>& b, size_t rows, size_t& rowDiff, size_t& doubletDiff) {
+  rowDiff = doubletDiff = 0;
+  for (size_t d = 0; d*rows < a.size(); ++d) {
+    size_t here = 0;
+    for (size_t y = 0; y < rows; ++y) here += a[d*rows + y] != b[d*rows + y];
+    rowDiff += here;
+    doubletDiff += here > 0;
+  }
+}
+
+// ================================================
+// d0 kernels: pvec reference against the row table + reduced d0, scalar and SIMD, per doublet
+static int benchRows(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  std::vector<std::pair<std::string, EventStore>> stores;
+  stores.push_back(std::make_pair(std::string("bundled sample"), sample));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup), opts.pileup, 4)));
+
+  const std::vector<std::pair<HoughD0Kernel, std::string>> kernels = {
+    {D0_TABLE, "row table + reduced d0"}, {D0_AVX2, "row table, AVX2"}, {D0_AVX512, "row table, AVX-512"}};
+
+  bool identical = true;
+  for (size_t k = 0; k < stores.size(); ++k) {
+    HoughConfig reference;
+    reference.m_d0Kernel = D0_REFERENCE;
+    std::vector<Doublet> doublets = collectDoublets(stores[k].second, reference);
+    std::vector<int> refBins, bins;
+    const double refTime = timeDoubletBins(doublets, reference, refBins);
+
+    printf(" %s: %zu doublets x %d rows\n", stores[k].first.c_str(), doublets.size(), reference.m_imageSize_y - 1);
+    printf(" %-30s %14s %9s %16s\n", "d0 kernel", "ns/doublet", "speedup", "rows differing");
+    printf(" %-30s %14.1f %9.2f %16s\n", "reference (pvec, pow, hypot)", refTime, 1.0, "-");
+    for (size_t i = 0; i < kernels.size(); ++i) {
+      if (!CpuSupports(kernels[i].first)) {
+        printf(" %-30s %14s\n", kernels[i].second.c_str(), "not supported");
+        continue;
+      }
+      HoughConfig config;
+      config.m_d0Kernel = kernels[i].first;
+      const double time = timeDoubletBins(doublets, config, bins);
+      size_t rowDiff, doubletDiff;
+      countMismatches(refBins, bins, reference.m_imageSize_y, rowDiff, doubletDiff);
+      identical = identical && rowDiff == 0;
+      printf(" %-30s %14.1f %9.2f %16zu\n", kernels[i].second.c_str(), time, refTime/time, rowDiff);
+    }
+  }
+  return identical ? 0 : 1;
+}
+
+// ================================================
+// Continuous fill: one increment per bin against the difference array + prefix sum
+static double timeFill(const EventStore& store, const HoughConfig& config, std::vector<HoughImage>& images) {
+  images.assign(store.nEvents(), HoughImage(config.m_imageSize_x, config.m_imageSize_y));
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t e = 0; e < store.nEvents(); ++e) FillImage(store, e, config, images[e]);
+  return secondsSince(start);
+}
+
+static int benchFill(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  std::vector<std::pair<std::string, EventStore>> stores;
+  stores.push_back(std::make_pair(std::string("bundled sample"), sample));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup), opts.pileup, 5)));
+
+  bool identical = true;
+  for (size_t k = 0; k < stores.size(); ++k) {
+    const EventStore& store = stores[k].second;
+    HoughConfig interpolate, difference;
+    interpolate.m_fillMode = FILL_INTERPOLATE;
+    difference.m_fillMode = FILL_DIFFERENCE;
+    std::vector<HoughImage> reference, images;
+    const double refTime = timeFill(store, interpolate, reference);
+    const double time = timeFill(store, difference, images);
+
+    bool same = true;
+    double increments = 0;
+    for (size_t e = 0; e < store.nEvents(); ++e) {
+      same = same && sameImage(reference[e], images[e], interpolate);
+      for (int x = 0; x < interpolate.m_imageSize_x; ++x) {
+        for (int y = 0; y < interpolate.m_imageSize_y; ++y) increments += reference[e](x, y);
+      }
+    }
+    identical = identical && same;
+    const size_t ndoublets = collectDoublets(store, interpolate).size();
+
+    printf(" %s: %zu events, %zu doublets, %.1f bins incremented per doublet\n", stores[k].first.c_str(), store.nEvents(), ndoublets, increments/ndoublets);
+    printf(" %-30s %10s %14s %s\n", "fill", "time[s]", "ns/doublet", "accumulator");
+    printf(" %-30s %10.3f %14.1f %s\n", "interpolate (bin by bin)", refTime, 1e9*refTime/ndoublets, "reference");
+    printf(" %-30s %10.3f %14.1f %s\n", "difference array + prefix sum", time, 1e9*time/ndoublets, same ? "identical" : "DIFFERENT");
+  }
+  return identical ? 0 : 1;
+}
+
+// ================================================
+// Peak finding: passThreshold + isLocalMaxima on every bin against the fused FindPeaks pass
+static void scanPeaks(HoughImage& image, const HoughConfig& config, std::vector<HoughPeak>& peaks) {
+  for (int y = 0; y < config.m_imageSize_y; y++) {
+    for (int x = 0; x < config.m_imageSize_x; x++) {
+      if (passThreshold(image, x, y, config) && isLocalMaxima(image, x, y, config.m_imageSize_x, config.m_imageSize_y)) {
+        HoughPeak peak;
+        peak.x = x; peak.y = y; peak.count = image(x, y);
+        peaks.push_back(peak);
+      }
+    }
+  }
+}
+
+static int benchPeaks(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  std::vector<std::pair<std::string, EventStore>> stores;
+  stores.push_back(std::make_pair(std::string("bundled sample"), sample));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup), opts.pileup, 6)));
+
+  bool identical = true;
+  for (size_t k = 0; k < stores.size(); ++k) {
+    const EventStore& store = stores[k].second;
+    HoughConfig config;
+    std::vector<HoughImage> images;
+    timeFill(store, config, images);
+
+    std::vector<HoughPeak> reference, peaks;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t e = 0; e < images.size(); ++e) scanPeaks(images[e], config, reference);
+    const double scanTime = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    for (size_t e = 0; e < images.size(); ++e) FindPeaks(images[e], config, peaks);
+    const double time = secondsSince(start);
+
+    bool same = reference.size() == peaks.size();
+    for (size_t i = 0; same && i < peaks.size(); ++i) {
+      same = reference[i].x == peaks[i].x && reference[i].y == peaks[i].y && reference[i].count == peaks[i].count;
+    }
+    identical = identical && same;
+
+    printf(" %s: %zu events, %zu peaks\n", stores[k].first.c_str(), store.nEvents(), reference.size());
+    printf(" %-36s %14s %9s %s\n", "peak finder", "us/event", "speedup", "peaks");
+    printf(" %-36s %14.1f %9.2f %s\n", "passThreshold + isLocalMaxima", 1e6*scanTime/images.size(), 1.0, "reference");
+    printf(" %-36s %14.1f %9.2f %s\n", "FindPeaks (fused, separable 3x3)", 1e6*time/images.size(), scanTime/time, same ? "identical" : "DIFFERENT");
+  }
+  return identical ? 0 : 1;
+}
+
+// ================================================
+// Doublet generation: all-pairs loop against the layer/radius buckets of MakeDoublets
+static bool sameDoublet(const Doublet& a, const Doublet& b) {
+  return a.hit1 == b.hit1 && a.hit2 == b.hit2 && a.mid == b.mid && a.half == b.half;
+}
+
+static int benchDoublets(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  std::vector<std::pair<std::string, EventStore>> stores;
+  stores.push_back(std::make_pair(std::string("bundled sample"), sample));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup), opts.pileup, 7)));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(4*opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup/4), 4*opts.pileup, 8)));
+
+  HoughConfig config;
+  bool identical = true;
+  for (size_t k = 0; k < stores.size(); ++k) {
+    const EventStore& store = stores[k].second;
+    double pairs = 0;
+    for (size_t e = 0; e < store.nEvents(); ++e) pairs += 0.5 * store.nHits(e) * (store.nHits(e) - 1);
+
+    // one event's doublets at a time, both generators write into a reused vector
+    std::vector<Doublet> reference, bucketed, event;
+    double allPairsTime = 0, time = 0;
+    for (size_t e = 0; e < store.nEvents(); ++e) {
+      event.clear();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      allPairsDoublets(store, e, config, event);
+      allPairsTime += secondsSince(start);
+      reference.insert(reference.end(), event.begin(), event.end());
+
+      start = std::chrono::steady_clock::now();
+      MakeDoublets(store, e, store.begin(e), store.end(e), config, event);
+      time += secondsSince(start);
+      bucketed.insert(bucketed.end(), event.begin(), event.end());
+    }
+
+    // same doublets, the buckets only change the order
+    std::sort(bucketed.begin(), bucketed.end(), [](const Doublet& a, const Doublet& b) {
+      return a.hit1 != b.hit1 ? a.hit1 < b.hit1 : a.hit2 < b.hit2;
+    });
+    bool same = reference.size() == bucketed.size();
+    for (size_t i = 0; same && i < reference.size(); ++i) same = sameDoublet(reference[i], bucketed[i]);
+    identical = identical && same;
+
+    printf(" %s: %zu events, %.0f hits/event, %.0f candidate pairs, %zu doublets\n", stores[k].first.c_str(), store.nEvents(),
+           double(store.nHits())/store.nEvents(), pairs, reference.size());
+    printf(" %-28s %14s %9s %s\n", "doublet generator", "us/event", "speedup", "doublets");
+    printf(" %-28s %14.2f %9.2f %s\n", "all pairs", 1e6*allPairsTime/store.nEvents(), 1.0, "reference");
+    printf(" %-28s %14.2f %9.2f %s\n", "layer/radius buckets", 1e6*time/store.nEvents(), allPairsTime/time, same ? "identical" : "DIFFERENT");
+  }
+  return identical ? 0 : 1;
+}
+
+// ================================================
+// tk (kernel/kernel.cxx) built with g++ and the hls::stream shim, against the all-pairs hit selection
+static void allPairsSelection(const EventStore& store, size_t event, const BenchOptions& opts, std::vector<WireHit>& kept) {
+  const size_t first = store.begin(event), n = store.nHits(event);
+  for (size_t j = 0; j < n; ++j) {
+    bool keep = (j == 0);
+    for (size_t i = 0; i < j && !keep; ++i) {
+      const double radiusDifference = std::abs((double) store.r()[first+j] - (double) store.r()[first+i]);
+      if (store.layer()[first+i] == store.layer()[first+j]) continue;
+      keep = 200 < radiusDifference && radiusDifference < 600;
+      if (!keep) continue;
+      // r-z windows, the wire radius of the hits as in the kernel
+      const size_t in = (store.r()[first+i] < store.r()[first+j]) ? first+i : first+j, out = (in == first+i) ? first+j : first+i;
+      const double r1 = store.r()[in], r2 = store.r()[out], z1 = store.z()[in], z2 = store.z()[out];
+      if (opts.z0Window > 0) keep = std::abs(z1 - r1*GetDz(z1, z2)/(r2 - r1)) < opts.z0Window;
+      if (opts.detaWindow > 0 && keep) keep = std::abs(GetDeta(store.x()[in], store.y()[in], z1, store.x()[out], store.y()[out], z2)) < opts.detaWindow;
+    }
+    if (!keep) continue;
+    WireHit hit;
+    hit.r = store.r()[first+j]; hit.x = store.x()[first+j]; hit.y = store.y()[first+j]; hit.z = store.z()[first+j];
+    hit.layer = store.layer()[first+j];
+    hit.flags = WIREHIT_KEPT;
+    kept.push_back(hit);
+  }
+}
+
+static int benchSelect(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  std::vector<std::pair<std::string, EventStore>> stores;
+  stores.push_back(std::make_pair(std::string("bundled sample"), sample));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup), opts.pileup, 10)));
+  // more hits than the kernel holds on chip, processed in blocks
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(16*opts.pileup), MakeSyntheticSample(sample, 4, 16*opts.pileup, 11)));
+
+  bool identical = true;
+  for (size_t k = 0; k < stores.size(); ++k) {
+    const EventStore& store = stores[k].second;
+    std::vector<WireHit> reference;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t e = 0; e < store.nEvents(); ++e) allPairsSelection(store, e, opts, reference);
+    const double referenceTime = secondsSince(start);
+
+    std::vector<EventBatch> batches = MakeBatches(store, opts.batch);
+    std::vector<WireHit> hits(std::max<size_t>(1, MaxBatchHits(batches))), out(hits.size()), selected;
+    std::vector<uint32_t> offsets(opts.batch + 1), counts(opts.batch + 1);
+    double kernelTime = 0;
+    for (size_t b = 0; b < batches.size(); ++b) {
+      PackEventBatch(store, batches[b], hits.data(), offsets.data());
+      start = std::chrono::steady_clock::now();
+      tk(hits.data(), out.data(), offsets.data(), counts.data(), batches[b].nevents, opts.z0Window, opts.detaWindow);
+      kernelTime += secondsSince(start);
+      selected.insert(selected.end(), out.begin(), out.begin() + counts[batches[b].nevents]);
+    }
+
+    bool same = reference.size() == selected.size();
+    for (size_t i = 0; same && i < selected.size(); ++i) {
+      same = memcmp(&reference[i], &selected[i], sizeof(WireHit)) == 0;
+    }
+    identical = identical && same;
+
+    size_t maxHits = 0;
+    for (size_t e = 0; e < store.nEvents(); ++e) maxHits = std::max(maxHits, store.nHits(e));
+    printf(" %s: %zu events, %.0f hits/event (max %zu), %zu hits kept\n", stores[k].first.c_str(), store.nEvents(),
+           double(store.nHits())/store.nEvents(), maxHits, reference.size());
+    printf(" %-36s %14s %s\n", "hit selection", "us/event", "hits");
+    printf(" %-36s %14.1f %s\n", "all pairs (CPU)", 1e6*referenceTime/store.nEvents(), "reference");
+    printf(" %-36s %14.1f %s\n", "tk dataflow C simulation", 1e6*kernelTime/store.nEvents(), same ? "identical" : "DIFFERENT");
+  }
+  return identical ? 0 : 1;
+}
+
+// ================================================
+// tkHough (kernel/hough_kernel.cxx) built with g++ as the C simulation of the card, against HoughEvent
+static int benchKernel(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  std::vector<std::pair<std::string, EventStore>> stores;
+  stores.push_back(std::make_pair(std::string("bundled sample"), sample));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup), opts.pileup, 9)));
+
+  HoughConfig config;
+  config.m_collectHits = false; // the card only returns the bins
+  config.m_z0Window = opts.z0Window;
+  config.m_detaWindow = opts.detaWindow;
+  bool identical = true;
+  for (size_t k = 0; k < stores.size(); ++k) {
+    const EventStore& store = stores[k].second;
+    std::vector<Road> reference, roads;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ProcessEvents(store, config, reference);
+    const double cpuTime = secondsSince(start);
+
+    std::vector<EventBatch> batches = MakeBatches(store, opts.batch);
+    std::vector<WireHit> hits(std::max<size_t>(1, MaxBatchHits(batches)));
+    std::vector<uint32_t> offsets(opts.batch + 1), counts(opts.batch + 1);
+    std::vector<WireRoad> found(opts.batch * WIREROAD_MAX_PER_EVENT);
+    HoughImage image(config.m_imageSize_x, config.m_imageSize_y);
+    size_t overflows = 0;
+    double kernelTime = 0;
+    for (size_t b = 0; b < batches.size(); ++b) {
+      const EventBatch& batch = batches[b];
+      PackEventBatch(store, batch, hits.data(), offsets.data());
+      start = std::chrono::steady_clock::now();
+      tkHough(hits.data(), found.data(), offsets.data(), counts.data(), batch.nevents, config.m_z0Window, config.m_detaWindow);
+      kernelTime += secondsSince(start);
+      for (size_t e = 0; e < batch.nevents; ++e) {
+        const WireRoad* first = &found[counts[e]];
+        if (counts[e+1] - counts[e] == 1 && (first->flags & WIREROAD_OVERFLOW)) { // left to the host
+          HoughEvent(store, batch.first + e, config, image, roads);
+          overflows++;
+          continue;
+        }
+        for (const WireRoad* r = first; r != &found[0] + counts[e+1]; ++r) {
+          Road road;
+          road.event = batch.first + r->event;
+          road.x = r->x;
+          road.y = r->y;
+          road.count = r->count;
+          roads.push_back(road);
+        }
+      }
+    }
+    const bool same = sameRoads(reference, roads);
+    identical = identical && same;
+
+    printf(" %s: %zu events, %.0f hits/event, %zu roads, %zu events over the on-chip limits\n", stores[k].first.c_str(), store.nEvents(),
+           double(store.nHits())/store.nEvents(), reference.size(), overflows);
+    printf(" %-36s %14s %s\n", "Hough", "us/event", "roads");
+    printf(" %-36s %14.1f %s\n", "HoughEvent (CPU)", 1e6*cpuTime/store.nEvents(), "reference");
+    printf(" %-36s %14.1f %s\n", "tkHough C simulation", 1e6*kernelTime/store.nEvents(), same ? "identical" : "DIFFERENT");
+  }
+  return identical ? 0 : 1;
+}
+
+// ================================================
+// Multi-CU dispatch against a fake device: CPU threads stand in for the compute units. Each fake CU runs
+// the tkHough C simulation on one batch at a time, behind `depth` sets of buffers driven by the
+// BatchDispatcher exactly as OpenCLBackend drives the card. CU c is made (1 + c*skew) times slower, so
+// the load balancing shows in the batches each CU takes, while the roads must not depend on it.
+struct FakeSlot {
+  std::vector<WireHit> hits;
+  std::vector<uint32_t> offsets, counts;
+  std::vector<WireRoad> found;
+};
+
+static int benchDispatch(const BenchOptions& opts) {
+  EventStore store = LoadEventStore(opts.file, opts.nthreads);
+  HoughConfig config;
+  config.m_collectHits = false; // the card only returns the bins
+  std::vector<Road> reference;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ProcessEvents(store, config, reference);
+  const double serial = secondsSince(start);
+
+  const unsigned depth = 2;
+  std::vector<EventBatch> batches = MakeBatches(store, opts.batch);
+  const size_t maxHits = std::max<size_t>(1, MaxBatchHits(batches));
+  printf(" bundled sample: %zu events in %zu batches of %zu, %zu roads, %u slots per CU, CU c (1 + %.2f c) times slower\n",
+         store.nEvents(), batches.size(), opts.batch, reference.size(), depth, opts.skew);
+  printf(" %4s %10s %12s %9s %-10s %s\n", "CUs", "time[s]", "events/s", "speedup", "roads", "batches per CU");
+  printf(" %4s %10.3f %12.1f %9.2f %-10s\n", "CPU", serial, store.nEvents()/serial, 1.0, "reference");
+
+  bool identical = true;
+  std::vector<unsigned> steps = threadSteps(opts.ncu);
+  for (size_t k = 0; k < steps.size(); ++k) {
+    const unsigned ncu = steps[k];
+    std::vector<std::mutex> busy(ncu); // a CU runs one batch at a time
+    std::vector<FakeSlot> slots(ncu * depth);
+    std::vector<HoughImage> images(ncu * depth, HoughImage(config.m_imageSize_x, config.m_imageSize_y));
+    for (size_t d = 0; d < slots.size(); ++d) {
+      slots[d].hits.resize(maxHits);
+      slots[d].offsets.resize(opts.batch + 1);
+      slots[d].counts.resize(opts.batch + 1);
+      slots[d].found.resize(opts.batch * WIREROAD_MAX_PER_EVENT);
+    }
+
+    BatchDispatcher dispatcher(ncu, depth);
+    std::vector<Road> roads;
+    start = std::chrono::steady_clock::now();
+    dispatcher.run(batches.size(), [&](unsigned cu, unsigned s, size_t b, std::vector<Road>& found) {
+      FakeSlot& slot = slots[cu * depth + s];
+      const EventBatch& batch = batches[b];
+      PackEventBatch(store, batch, slot.hits.data(), slot.offsets.data());
+      {
+        std::lock_guard<std::mutex> lock(busy[cu]);
+        std::chrono::steady_clock::time_point kernelStart = std::chrono::steady_clock::now();
+        tkHough(slot.hits.data(), slot.found.data(), slot.offsets.data(), slot.counts.data(), batch.nevents, config.m_z0Window, config.m_detaWindow);
+        std::this_thread::sleep_for(std::chrono::duration<double>(cu * opts.skew * secondsSince(kernelStart)));
+      }
+      for (size_t e = 0; e < batch.nevents; ++e) {
+        const WireRoad* first = &slot.found[slot.counts[e]];
+        if (slot.counts[e+1] - slot.counts[e] == 1 && (first->flags & WIREROAD_OVERFLOW)) { // left to the host
+          HoughEvent(store, batch.first + e, config, images[cu * depth + s], found);
+          continue;
+        }
+        for (const WireRoad* r = first; r != &slot.found[0] + slot.counts[e+1]; ++r) {
+          Road road;
+          road.event = batch.first + r->event;
+          road.x = r->x;
+          road.y = r->y;
+          road.count = r->count;
+          found.push_back(road);
+        }
+      }
+    }, roads);
+    const double time = secondsSince(start);
+    const bool same = sameRoads(reference, roads);
+    identical = identical && same;
+
+    std::string spread;
+    for (unsigned cu = 0; cu < ncu; ++cu) spread += (cu ? "/" : "") + std::to_string(dispatcher.batchesOn(cu));
+    printf(" %4u %10.3f %12.1f %9.2f %-10s %s\n", ncu, time, store.nEvents()/time, serial/time, same ? "identical" : "DIFFERENT", spread.c_str());
+  }
+  return identical ? 0 : 1;
+}
+
+// ================================================
+// Compile-time specialised engines against HoughEvent with the same parameters at runtime
+static double timeEvents(const EventStore& store, const std::function<void(size_t, HoughImage&, std::vector<Road>&)>& run, std::vector<Road>& roads) {
+  HoughImage image;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t event = 0; event < store.nEvents(); ++event) run(event, image, roads);
+  return secondsSince(start);
+}
+
+static int benchEngine(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  std::vector<std::pair<std::string, EventStore>> stores;
+  stores.push_back(std::make_pair(std::string("bundled sample"), sample));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup), opts.pileup, 9)));
+  std::vector<std::string> names = opts.engine.empty() ? HoughEngineNames() : std::vector<std::string>(1, opts.engine);
+
+  HoughConfig base;
+  base.m_collectHits = false; // fill and peaks only
+  bool identical = true;
+  for (size_t k = 0; k < stores.size(); ++k) {
+    const EventStore& store = stores[k].second;
+    printf(" %s: %zu events, %.0f hits/event\n", stores[k].first.c_str(), store.nEvents(), double(store.nHits())/store.nEvents());
+    printf(" %-18s %8s %14s %14s %14s %9s %s\n", "engine", "roads", "D0_TABLE[us]", "D0_SIMD[us]", "engine[us]", "speedup", "roads");
+    for (size_t e = 0; e < names.size(); ++e) {
+      std::unique_ptr<HoughEngineBase> engine = MakeHoughEngine(names[e], base);
+      HoughConfig table = engine->config(), simd = engine->config();
+      table.m_d0Kernel = D0_TABLE;
+      simd.m_d0Kernel = D0_SIMD;
+      std::vector<Road> tableRoads, simdRoads, roads;
+      const double tableTime = timeEvents(store, [&](size_t event, HoughImage& image, std::vector<Road>& out) { HoughEvent(store, event, table, image, out); }, tableRoads);
+      const double simdTime = timeEvents(store, [&](size_t event, HoughImage& image, std::vector<Road>& out) { HoughEvent(store, event, simd, image, out); }, simdRoads);
+      const double engineTime = timeEvents(store, [&](size_t event, HoughImage& image, std::vector<Road>& out) { engine->event(store, event, image, out); }, roads);
+
+      // the reference is the scalar row loop, which the engine follows operation for operation
+      const bool same = sameRoads(tableRoads, roads);
+      const bool exact = engine->name().find("float") == std::string::npos && engine->name().find("fixed") == std::string::npos; // float and fixed rows are expected to move a few bins
+      if (exact) identical = identical && same;
+      printf(" %-18s %8zu %14.1f %14.1f %14.1f %9.2f %s\n", engine->name().c_str(), tableRoads.size(), 1e6*tableTime/store.nEvents(),
+             1e6*simdTime/store.nEvents(), 1e6*engineTime/store.nEvents(), std::min(tableTime, simdTime)/engineTime,
+             same ? "identical" : (exact ? "DIFFERENT" : (std::to_string(roads.size()) + " roads").c_str()));
+    }
+  }
+  return identical ? 0 : 1;
+}
+
+// ================================================
+// Precision modes of the engine against its double rows, on the same events: throughput, d0 and q/pT
+// resolution of the best road of each event (highest count, the first one on ties) against the truth
+// of the event, and the peaks that differ from the ones found in double
+struct Resolution {
+  double sum, sum2;
+  size_t n;
+  Resolution() : sum(0), sum2(0), n(0) {}
+  void add(double r) { sum += r; sum2 += r*r; n++; }
+  double mean() const { return n ? sum/n : 0; }
+  double rms() const { return n ? std::sqrt(std::max(0., sum2/n - mean()*mean())) : 0; }
+};
+
+// [first, last) road of every event, the roads are in event order
+static std::vector<size_t> roadOffsets(const std::vector<Road>& roads, size_t nevents) {
+  std::vector<size_t> offsets(nevents + 1, 0);
+  for (size_t i = 0; i < roads.size(); ++i) offsets[roads[i].event + 1]++;
+  for (size_t e = 0; e < nevents; ++e) offsets[e + 1] += offsets[e];
+  return offsets;
+}
+
+static int benchPrecision(const BenchOptions& opts) {
+  const EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  const EventStore pileup = MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup), opts.pileup, 9);
+  std::vector<std::string> names;
+  names.push_back("216x216");
+  for (const std::string& name : HoughEngineNames()) {
+    const bool precision = name.find("float") != std::string::npos || name.find("fixed") != std::string::npos;
+    if (precision && (opts.engine.empty() || name == opts.engine)) names.push_back(name);
+  }
+
+  HoughConfig base;
+  base.m_collectHits = false;
+  printf(" bundled sample: %zu events; synthetic, pileup %u: %zu events, %.0f hits/event\n", sample.nEvents(), opts.pileup,
+         pileup.nEvents(), double(pileup.nHits())/pileup.nEvents());
+  printf(" %-20s %10s %10s %12s %12s %14s %14s %7s %7s %7s\n", "mode", "sample[us]", "pileup[us]", "d0 mean[mm]", "d0 rms[mm]",
+         "q/pT mean[/GeV]", "q/pT rms[/GeV]", "moved", "lost", "extra");
+
+  std::vector<Road> reference;
+  std::vector<size_t> referenceOffsets;
+  Resolution referenceD0, referenceQpt;
+  for (size_t m = 0; m < names.size(); ++m) {
+    std::unique_ptr<HoughEngineBase> engine = MakeHoughEngine(names[m], base);
+    const HoughConfig& config = engine->config();
+    std::vector<Road> roads, pileupRoads;
+    const double sampleTime = timeEvents(sample, [&](size_t event, HoughImage& image, std::vector<Road>& out) { engine->event(sample, event, image, out); }, roads);
+    const double pileupTime = timeEvents(pileup, [&](size_t event, HoughImage& image, std::vector<Road>& out) { engine->event(pileup, event, image, out); }, pileupRoads);
+    const std::vector<size_t> offsets = roadOffsets(roads, sample.nEvents());
+
+    Resolution d0, qpt;
+    size_t moved = 0, lost = 0, extra = 0;
+    for (size_t event = 0; event < sample.nEvents(); ++event) {
+      size_t best = offsets[event];
+      for (size_t i = offsets[event]; i < offsets[event + 1]; ++i) if (roads[i].count > roads[best].count) best = i;
+      if (best < offsets[event + 1]) {
+        d0.add(sample.d0(event) - xtod0(roads[best].x, config.stepX(), config.m_d0_range));
+        qpt.add(sample.charge(event) / sample.pt(event) - ytoqoverpt(roads[best].y, config.stepY(), config.m_qOverPt_range));
+      }
+      if (m == 0) continue;
+
+      // peaks by bin against the double ones of the same event
+      size_t referenceBest = referenceOffsets[event];
+      for (size_t i = referenceOffsets[event]; i < referenceOffsets[event + 1]; ++i) {
+        if (reference[i].count > reference[referenceBest].count) referenceBest = i;
+        bool found = false;
+        for (size_t j = offsets[event]; j < offsets[event + 1] && !found; ++j) found = roads[j].x == reference[i].x && roads[j].y == reference[i].y;
+        if (!found) lost++;
+      }
+      for (size_t j = offsets[event]; j < offsets[event + 1]; ++j) {
+        bool found = false;
+        for (size_t i = referenceOffsets[event]; i < referenceOffsets[event + 1] && !found; ++i) found = roads[j].x == reference[i].x && roads[j].y == reference[i].y;
+        if (!found) extra++;
+      }
+      const bool hasBest = best < offsets[event + 1], referenceHasBest = referenceBest < referenceOffsets[event + 1];
+      if (hasBest != referenceHasBest || (hasBest && (roads[best].x != reference[referenceBest].x || roads[best].y != reference[referenceBest].y))) moved++;
+    }
+    if (m == 0) {
+      reference = roads;
+      referenceOffsets = offsets;
+      referenceD0 = d0;
+      referenceQpt = qpt;
+    }
+
+    // double in absolute terms, the other modes as shifts from it
+    const double relative = m == 0 ? 0 : 1;
+    printf(" %-20s %10.1f %10.1f %+12.4f %+12.4f %+14.2e %+14.2e %7zu %7zu %7zu\n", engine->name().c_str(),
+           1e6*sampleTime/sample.nEvents(), 1e6*pileupTime/pileup.nEvents(),
+           d0.mean() - relative*referenceD0.mean(), d0.rms() - relative*referenceD0.rms(),
+           qpt.mean() - relative*referenceQpt.mean(), qpt.rms() - relative*referenceQpt.rms(), moved, lost, extra);
+  }
+  printf(" (the first row is double, the others are shifts from it; moved: events whose best road is in another bin)\n");
+  return 0;
+}
+
+// ================================================
+// Coarse-to-fine search against the flat fill on the default grid and on a finer one: time per event, and
+// the roads of the flat fill that the coarse pass lost (missed), found with another count, or added
+static int benchCoarse(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  std::vector<std::pair<std::string, EventStore>> stores;
+  stores.push_back(std::make_pair(std::string("bundled sample"), sample));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup), opts.pileup, 10)));
+  const std::vector<int> coarseSizes = opts.coarse > 0 ? std::vector<int>(1, opts.coarse) : std::vector<int>{27, 54, 108};
+
+  bool allFound = true;
+  for (size_t k = 0; k < stores.size(); ++k) {
+    const EventStore& store = stores[k].second;
+    printf(" %s: %zu events, %.0f hits/event\n", stores[k].first.c_str(), store.nEvents(), double(store.nHits())/store.nEvents());
+    printf(" %-20s %12s %9s %8s %8s %8s %8s\n", "fill", "us/event", "speedup", "roads", "missed", "count", "extra");
+    for (int size : {216, 864}) {
+      HoughConfig flat;
+      flat.m_collectHits = false; // fill and peaks only
+      flat.m_imageSize_x = flat.m_imageSize_y = size;
+      std::vector<Road> reference;
+      const double flatTime = timeEvents(store, [&](size_t event, HoughImage& image, std::vector<Road>& out) { HoughEvent(store, event, flat, image, out); }, reference);
+      const std::vector<size_t> referenceOffsets = roadOffsets(reference, store.nEvents());
+      const std::string grid = std::to_string(size) + "x" + std::to_string(size);
+      printf(" %-20s %12.1f %9.2f %8zu %8s %8s %8s\n", ("flat " + grid).c_str(), 1e6*flatTime/store.nEvents(), 1., reference.size(), "-", "-", "-");
+
+      for (size_t c = 0; c < coarseSizes.size(); ++c) {
+        if (size % coarseSizes[c] != 0) continue;
+        HoughConfig config = flat;
+        config.m_coarseFactor = size / coarseSizes[c];
+        std::vector<Road> roads;
+        const double time = timeEvents(store, [&](size_t event, HoughImage& image, std::vector<Road>& out) { HoughEvent(store, event, config, image, out); }, roads);
+        const std::vector<size_t> offsets = roadOffsets(roads, store.nEvents());
+
+        // both lists are in FindPeaks order (q/pT row, then d0 bin) within an event
+        size_t missed = 0, count = 0, extra = 0;
+        for (size_t event = 0; event < store.nEvents(); ++event) {
+          size_t j = offsets[event];
+          for (size_t i = referenceOffsets[event]; i < referenceOffsets[event + 1]; ++i) {
+            const Road& r = reference[i];
+            while (j < offsets[event + 1] && (roads[j].y < r.y || (roads[j].y == r.y && roads[j].x < r.x))) { extra++; j++; }
+            if (j < offsets[event + 1] && roads[j].x == r.x && roads[j].y == r.y) {
+              if (roads[j].count != r.count) count++;
+              j++;
+            } else {
+              missed++;
+            }
+          }
+          extra += offsets[event + 1] - j;
+        }
+        allFound = allFound && missed == 0 && count == 0 && extra == 0;
+        const std::string name = std::to_string(coarseSizes[c]) + "x" + std::to_string(coarseSizes[c]) + " -> " + grid;
+        printf(" %-20s %12.1f %9.2f %8zu %8zu %8zu %8zu\n", name.c_str(), 1e6*time/store.nEvents(), flatTime/time, roads.size(), missed, count, extra);
+      }
+    }
+  }
+  return allFound ? 0 : 1;
+}
+
+// ================================================
+// Phi sectors against the global accumulator: doublets and hits per wedge, time per event with the wedges
+// one after the other and on the pool, the bins of the global roads that the wedges find or not, and the
+// events with a road within 3 bins of the truth (of the first overlay in the synthetic events)
+static size_t eventsNearTruth(const EventStore& store, const std::vector<Road>& roads, const HoughConfig& config) {
+  const std::vector<size_t> offsets = roadOffsets(roads, store.nEvents());
+  size_t events = 0;
+  for (size_t event = 0; event < store.nEvents(); ++event) {
+    for (size_t i = offsets[event]; i < offsets[event + 1]; ++i) {
+      const double dx = (xtod0(roads[i].x, config.stepX(), config.m_d0_range) - store.d0(event)) / config.stepX();
+      const double dy = (ytoqoverpt(roads[i].y, config.stepY(), config.m_qOverPt_range) - store.charge(event)/store.pt(event)) / config.stepY();
+      if (std::abs(dx) <= 3 && std::abs(dy) <= 3) { events++; break; }
+    }
+  }
+  return events;
+}
+
+static int benchSectors(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  std::vector<std::pair<std::string, EventStore>> stores;
+  stores.push_back(std::make_pair(std::string("bundled sample"), sample));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup), opts.pileup, 11)));
+  const std::vector<int> counts = opts.sectors > 1 ? std::vector<int>(1, opts.sectors) : std::vector<int>{4, 8, 16};
+  ThreadPool pool(opts.nthreads);
+
+  HoughConfig global;
+  global.m_collectHits = false; // fill and peaks only
+  if (opts.overlap >= 0) global.m_phiOverlap = opts.overlap;
+  bool identical = true;
+  for (size_t k = 0; k < stores.size(); ++k) {
+    const EventStore& store = stores[k].second;
+    std::vector<Road> reference;
+    const double globalTime = timeEvents(store, [&](size_t event, HoughImage& image, std::vector<Road>& out) { HoughEvent(store, event, global, image, out); }, reference);
+    const std::vector<size_t> referenceOffsets = roadOffsets(reference, store.nEvents());
+    std::vector<Doublet> doublets;
+    size_t globalDoublets = 0;
+    for (size_t event = 0; event < store.nEvents(); ++event) {
+      MakeDoublets(store, event, store.begin(event), store.end(event), global, doublets);
+      globalDoublets += doublets.size();
+    }
+
+    printf(" %s: %zu events, %.0f hits/event, %.0f doublets/event, overlap %.2f rad, %u threads\n", stores[k].first.c_str(), store.nEvents(),
+           double(store.nHits())/store.nEvents(), double(globalDoublets)/store.nEvents(), global.m_phiOverlap, pool.size());
+    printf(" %-10s %10s %10s %11s %11s %9s %8s %8s %8s %7s %s\n", "sectors", "hits/sect", "doublets", "serial[us]", "pool[us]", "speedup", "roads", "found", "extra", "truth", "pool");
+    printf(" %-10s %10.1f %10.2f %11.1f %11s %9.2f %8zu %8s %8s %7zu\n", "global", double(store.nHits())/store.nEvents(), 1., 1e6*globalTime/store.nEvents(), "-", 1.,
+           reference.size(), "-", "-", eventsNearTruth(store, reference, global));
+    for (size_t c = 0; c < counts.size(); ++c) {
+      HoughConfig config = global;
+      config.m_phiSectors = counts[c];
+
+      std::vector<std::vector<unsigned>> sectors;
+      size_t sectorHits = 0, sectorDoublets = 0;
+      for (size_t event = 0; event < store.nEvents(); ++event) {
+        PhiSectorHits(store, event, config, sectors);
+        for (size_t s = 0; s < sectors.size(); ++s) {
+          MakeDoublets(store, sectors[s], config, doublets);
+          sectorHits += sectors[s].size();
+          sectorDoublets += doublets.size();
+        }
+      }
+
+      std::vector<Road> roads, pooled;
+      std::vector<HoughImage> images;
+      const double serialTime = timeEvents(store, [&](size_t event, HoughImage& image, std::vector<Road>& out) { HoughEvent(store, event, config, image, out); }, roads);
+      const double poolTime = timeEvents(store, [&](size_t event, HoughImage&, std::vector<Road>& out) { HoughEventSectors(store, event, config, pool, images, out); }, pooled);
+      const bool same = sameRoads(roads, pooled);
+      identical = identical && same;
+
+      // bins of the global roads found by the wedges, whatever their count there
+      const std::vector<size_t> offsets = roadOffsets(roads, store.nEvents());
+      size_t found = 0;
+      for (size_t event = 0; event < store.nEvents(); ++event) {
+        for (size_t i = referenceOffsets[event]; i < referenceOffsets[event + 1]; ++i) {
+          for (size_t j = offsets[event]; j < offsets[event + 1]; ++j) {
+            if (roads[j].x == reference[i].x && roads[j].y == reference[i].y) { found++; break; }
+          }
+        }
+      }
+      printf(" %-10d %10.1f %10.2f %11.1f %11.1f %9.2f %8zu %8zu %8zu %7zu %s\n", counts[c], double(sectorHits)/(store.nEvents()*counts[c]),
+             double(sectorDoublets)/globalDoublets, 1e6*serialTime/store.nEvents(), 1e6*poolTime/store.nEvents(), globalTime/std::min(serialTime, poolTime),
+             roads.size(), found, roads.size() - found, eventsNearTruth(store, roads, config), same ? "identical" : "DIFFERENT");
+      // one track per event: the wedges see no other track, so every road they add is a duplicate of the merge
+      if (k == 0 && roads.size() != found) {
+        printf(" ERROR: %zu roads on single-track events that the global accumulator does not have\n", roads.size() - found);
+        identical = false;
+      }
+    }
+  }
+  printf(" (doublets: sum over the wedges / global; found: global road bins that are also wedge roads; truth: events with a road near the truth)\n");
+  return identical ? 0 : 1;
+}
+
+// ================================================
+// r-z pre-filter of the doublets: doublets per event, time per event of MakeDoublets and of HoughEvent, roads
+// and events with a road near the truth, without windows and with each pair of windows, at two pileups
+static int benchRZ(const BenchOptions& opts) {
+  EventStore sample = LoadEventStore(opts.file, opts.nthreads);
+  std::vector<std::pair<std::string, EventStore>> stores;
+  stores.push_back(std::make_pair(std::string("bundled sample"), sample));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/opts.pileup), opts.pileup, 12)));
+  stores.push_back(std::make_pair("synthetic, pileup " + std::to_string(4*opts.pileup), MakeSyntheticSample(sample, std::max<size_t>(1, opts.nevents/(4*opts.pileup)), 4*opts.pileup, 13)));
+  std::vector<std::pair<float, float>> windows; // (z0 [mm], eta), 0 for none
+  windows.push_back(std::make_pair(0.f, 0.f));
+  if (opts.z0Window > 0 || opts.detaWindow > 0) windows.push_back(std::make_pair(opts.z0Window, opts.detaWindow));
+  else windows.insert(windows.end(), {{300.f, 0.f}, {0.f, 0.3f}, {300.f, 0.3f}, {200.f, 0.2f}});
+
+  HoughConfig base;
+  base.m_collectHits = false; // fill and peaks only
+  for (size_t k = 0; k < stores.size(); ++k) {
+    const EventStore& store = stores[k].second;
+    printf(" %s: %zu events, %.0f hits/event\n", stores[k].first.c_str(), store.nEvents(), double(store.nHits())/store.nEvents());
+    printf(" %-9s %-6s %12s %8s %13s %11s %9s %8s %7s\n", "z0[mm]", "deta", "doublets/evt", "kept", "doublets[us]", "hough[us]", "speedup", "roads", "truth");
+    size_t allDoublets = 0;
+    double allTime = 0;
+    for (size_t w = 0; w < windows.size(); ++w) {
+      HoughConfig config = base;
+      config.m_z0Window = windows[w].first;
+      config.m_detaWindow = windows[w].second;
+
+      std::vector<Doublet> doublets;
+      size_t ndoublets = 0;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for (size_t event = 0; event < store.nEvents(); ++event) {
+        MakeDoublets(store, event, store.begin(event), store.end(event), config, doublets);
+        ndoublets += doublets.size();
+      }
+      const double doubletTime = secondsSince(start);
+      std::vector<Road> roads;
+      const double time = timeEvents(store, [&](size_t event, HoughImage& image, std::vector<Road>& out) { HoughEvent(store, event, config, image, out); }, roads);
+      if (w == 0) { allDoublets = ndoublets; allTime = time; }
+
+      const std::string z0 = config.m_z0Window > 0 ? std::to_string((int) config.m_z0Window) : "-";
+      char deta[16] = "-";
+      if (config.m_detaWindow > 0) snprintf(deta, sizeof(deta), "%.2f", config.m_detaWindow);
+      printf(" %-9s %-6s %12.1f %8.3f %13.1f %11.1f %9.2f %8zu %7zu\n", z0.c_str(), deta, double(ndoublets)/store.nEvents(),
+             double(ndoublets)/std::max<size_t>(1, allDoublets), 1e6*doubletTime/store.nEvents(), 1e6*time/store.nEvents(), allTime/time,
+             roads.size(), eventsNearTruth(store, roads, config));
+    }
+  }
+  printf(" (kept: doublets with the windows / without; hough: HoughEvent per event, doublets included; truth: events with a road near the truth)\n");
+  return 0;
+}
+
+int main(int argc,char *argv[]){
+
+  if (argc < 2) {
+    std::cout << "usage: " << argv[0] << " parse|threads|intra|rows|fill|peaks|doublets|select|kernel|dispatch|engine|precision|coarse|sectors|rz [--data file] [--scale N] [--threads N] [--events N] [--pileup N] [--batch N] [--latency us] [--cu N] [--skew f] [--engine name] [--coarse N] [--sectors N] [--overlap rad] [--z0window mm] [--deta w]" << std::endl;
+    return 1;
+  }
+  std::string mode = argv[1];
+
+  BenchOptions opts;
+  static struct option long_options[] =
+  {
+    {"data", 1, NULL, 'c'},
+    {"out", 1, NULL, 'o'},
+    {"scale", 1, NULL, 's'},
+    {"threads", 1, NULL, 't'},
+    {"events", 1, NULL, 'e'},
+    {"pileup", 1, NULL, 'u'},
+    {"batch", 1, NULL, 'b'},
+    {"latency", 1, NULL, 'l'},
+    {"cu", 1, NULL, 'n'},
+    {"skew", 1, NULL, 'w'},
+    {"engine", 1, NULL, 'g'},
+    {"coarse", 1, NULL, 'r'},
+    {"sectors", 1, NULL, 'y'},
+    {"overlap", 1, NULL, 'v'},
+    {"z0window", 1, NULL, 'z'},
+    {"deta", 1, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int opt;
+  optind = 2;
+  while ( (opt = getopt_long(argc, argv,"costeublnwgryvzh", long_options, NULL)) != -1 ) {  // for each option...
+    switch ( opt )
+      {
+      case 'c': opts.file = optarg; break;
+      case 'o': opts.outFile = optarg; break;
+      case 's': opts.scale = atoi(optarg); break;
+      case 't': opts.nthreads = atoi(optarg); break;
+      case 'e': opts.nevents = atol(optarg); break;
+      case 'u': opts.pileup = atoi(optarg); break;
+      case 'b': opts.batch = atol(optarg); break;
+      case 'l': opts.latency = atof(optarg); break;
+      case 'n': opts.ncu = atoi(optarg); break;
+      case 'w': opts.skew = atof(optarg); break;
+      case 'g': opts.engine = optarg; break;
+      case 'r': opts.coarse = atoi(optarg); break;
+      case 'y': opts.sectors = atoi(optarg); break;
+      case 'v': opts.overlap = atof(optarg); break;
+      case 'z': opts.z0Window = atof(optarg); break;
+      case 'h': opts.detaWindow = atof(optarg); break;
+      case 0: break;
+      }
+  }
+
+  if (mode == "parse") return benchParse(opts);
+  if (mode == "threads") return benchThreads(opts);
+  if (mode == "intra") return benchIntra(opts);
+  if (mode == "rows") return benchRows(opts);
+  if (mode == "fill") return benchFill(opts);
+  if (mode == "peaks") return benchPeaks(opts);
+  if (mode == "doublets") return benchDoublets(opts);
+  if (mode == "select") return benchSelect(opts);
+  if (mode == "kernel") return benchKernel(opts);
+  if (mode == "dispatch") return benchDispatch(opts);
+  if (mode == "engine") return benchEngine(opts);
+  if (mode == "precision") return benchPrecision(opts);
+  if (mode == "coarse") return benchCoarse(opts);
+  if (mode == "sectors") return benchSectors(opts);
+  if (mode == "rz") return benchRZ(opts);
+
+  std::cout << "unknown benchmark " << mode << std::endl;
+  return 1;
+}
@@ -0,0 +1,45 @@
+#include "EventFormat.h"
+#include "MergeParser.h"
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <cstdlib>
+using namespace std;
+
+// Converts a merged text file (txtfiles/merge.txt) into the binary columnar event format
+int main(int argc,char *argv[]){
+
+  std::string file, outFile;
+  unsigned nthreads = DefaultThreads();
+  static struct option long_options[] =
+  {
+    {"data", 1, NULL, 'c'},
+    {"out", 1, NULL, 'o'},
+    {"threads", 1, NULL, 't'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int opt;
+  while ( (opt = getopt_long(argc, argv,"cot", long_options, NULL)) != -1 ) {  // for each option...
+    switch ( opt )
+      {
+      case 'c': file = optarg; break;
+      case 'o': outFile = optarg; break;
+      case 't': nthreads = atoi(optarg); break;
+      case 0: break;
+      }
+  }
+  if (file.empty() || outFile.empty()) {
+    std::cout << "usage: " << argv[0] << " --data merge.txt --out merge.htev [--threads N]" << std::endl;
+    return 1;
+  }
+
+  EventColumns cols;
+  ParseMergeText(file, cols, nthreads);
+  WriteEventFile(outFile, cols);
+
+  MappedEventFile check(outFile);
+  std::cout << " wrote " << outFile << ": " << check.nEvents() << " events, " << check.nHits() << " hits" << std::endl;
+
+  return 0;
+}
@@ -1,53 +1,91 @@
 #include "plotHelper.h"
 #include "HoughHelper.h"
+#include "EventStore.h"
+#include "MergeParser.h"
+#include "Backend.h"
 #include <getopt.h>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <stdexcept>
 #include <vector>
 #include <unistd.h>
 #include <array>
 #include <cmath>
 #include <unordered_set>
 using namespace std;
-#define NEVENTS 1000
 
 int main(int argc,char *argv[]){
 
   std::string inDir, outDir, file;
+  unsigned nthreads = DefaultThreads();
+  bool print = false;
+  std::string backendName; // cpu or threads, threads when there is more than one
+  HoughConfig config;
   static struct option long_options[] =
   {
     {"inDir", 1, NULL, 'a'},
     {"outDir", 1, NULL, 'b'},
     {"data", 1, NULL, 'c'},
+    {"threads", 1, NULL, 't'},
+    {"print", 0, NULL, 'p'},
+    {"latency", 1, NULL, 'l'},
+    {"backend", 1, NULL, 'g'},
+    {"sectors", 1, NULL, 's'},
+    {"coarse", 1, NULL, 'r'},
+    {"z0window", 1, NULL, 'z'},
+    {"deta", 1, NULL, 'w'},
+    {"precision", 1, NULL, 'x'},
     {NULL, 0, NULL, 0}
   };
 
   int opt;
-  while ( (opt = getopt_long(argc, argv,"abc", long_options, NULL)) != -1 ) {  // for each option...
+  while ( (opt = getopt_long(argc, argv,"abctplgsrzwx", long_options, NULL)) != -1 ) {  // for each option...
     switch ( opt )
       {
       case 'a': inDir = optarg; break;
       case 'b': outDir = optarg; break;
       case 'c': file = optarg; break;
+      case 't': nthreads = atoi(optarg); break;
+      case 'p': print = true; break;
+      case 'l': config.m_latencyTarget_us = atof(optarg); break; // split each event over the threads to meet this target
+      case 'g': backendName = optarg; break;
+      case 's': config.m_phiSectors = atoi(optarg); break; // transform each phi wedge of the events on its own
+      case 'r': config.m_coarseFactor = atoi(optarg); break; // coarse-to-fine search, first on a grid this many times coarser
+      case 'z': config.m_z0Window = atof(optarg); break; // r-z pre-filter of the doublets: |z0| window [mm]
+      case 'w': config.m_detaWindow = atof(optarg); break; // r-z pre-filter of the doublets: eta difference window
+      case 'x': // rows in double, float or fixed point (the 216x216 engines of include/HoughEngine.cxx)
+        try {
+          config.m_precision = ParsePrecision(optarg);
+        } catch (const std::invalid_argument& e) {
+          std::cout << "ERROR: " << e.what() << std::endl;
+          return EXIT_FAILURE;
+        }
+        break;
       case 0: break;
       }
   }
-  // std::vector<float> datavec;
-  std::vector<std::vector<float>> datavec(NEVENTS);
 
-  GetInfoFromFile(file, datavec);
-  print_info_vec_data(datavec, NEVENTS); // you could do this just to check
-  int nlines = 8884; // nlines is different than nevents, each event can have 8+ hits
-
-   //unsigned int size_vec = datavec.size();
-  // double data_arr[size_vec];
-  // ConvertVecToArr(datavec, data_arr);
-  // print_info_array_data(data_arr, size_vec);
+  // text files are parsed on nthreads, binary event files are mapped
+  EventStore events = LoadEventStore(file, nthreads);
+  std::cout << " data filename : " << file << " events: " << events.nEvents() << " hits: " << events.nHits() << std::endl;
+  if (print) print_info_event_store(events, events.nEvents()); // you could do this just to check
 
+  if (backendName.empty()) backendName = (nthreads > 1) ? "threads" : "cpu";
+  std::unique_ptr<HoughBackend> backend = MakeCpuBackend(backendName, config, nthreads);
+  std::vector<Road> roads;
+  try {
+    backend->run(events, MakeBatches(events, 16), roads);
+  } catch (const std::invalid_argument& e) {
+    std::cout << "ERROR: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
 
-  //SelectEvent(data_arr, nlines);
+  for (size_t i = 0; i < roads.size(); ++i) {
+    const size_t event = roads[i].event;
+    if (event==1 || event==2 || event == 3) PrintRoad(events, roads[i], config);
+  }
 
   return 0;
 
@@ -0,0 +1,27 @@
+#include "Backend.h"
+#include <cstdio>
+#include <stdexcept>
+
+#ifndef Backend_cxx
+#define Backend_cxx
+
+void CpuBackend::run(const EventStore& store, const std::vector<EventBatch>& batches, std::vector<Road>& roads){
+  ProcessEvents(store, m_config, batches, roads);
+}
+
+void ThreadedCpuBackend::run(const EventStore& store, const std::vector<EventBatch>& batches, std::vector<Road>& roads){
+  ProcessEvents(store, m_config, m_pool, batches, roads);
+}
+
+void ThreadedCpuBackend::report(double seconds) const {
+  printf(" %u threads, %s\n", m_pool.size(), m_config.m_latencyTarget_us > 0 ? "events split over the threads" : "one batch per thread");
+  (void) seconds;
+}
+
+std::unique_ptr<HoughBackend> MakeCpuBackend(const std::string& name, const HoughConfig& config, unsigned nthreads){
+  if (name == "cpu") return std::unique_ptr<HoughBackend>(new CpuBackend(config));
+  if (name == "threads") return std::unique_ptr<HoughBackend>(new ThreadedCpuBackend(config, std::max(1u, nthreads)));
+  throw std::runtime_error("MakeCpuBackend: unknown backend " + name + ", use cpu or threads");
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include "EventStore.h"
+#include "EventBatch.h"
+#include "HoughHelper.h"
+#include "ThreadPool.h"
+using namespace std;
+
+#ifndef Backend_h
+#define Backend_h
+
+// ================================================
+// ================================================
+// Compute backend of the Hough stage, shared by dataProcessor and host_openCL.
+// run() finds the roads of the events of batches and appends them to roads in event order, with
+// road.event the index of the event in the store, whatever the backend does underneath; road.hits is
+// only filled by the backends that collect hits (config.m_collectHits on the CPU).
+class HoughBackend {
+  public:
+    virtual ~HoughBackend() {}
+    virtual std::string name() const = 0;
+    virtual void run(const EventStore& store, const std::vector<EventBatch>& batches, std::vector<Road>& roads) = 0;
+    // what the backend knows about the last run, e.g. the occupancy of its stages
+    virtual void report(double seconds) const { (void) seconds; }
+};
+
+// one event after the other, one accumulator
+class CpuBackend : public HoughBackend {
+  public:
+    explicit CpuBackend(const HoughConfig& config) : m_config(config) {}
+    std::string name() const { return "cpu"; }
+    void run(const EventStore& store, const std::vector<EventBatch>& batches, std::vector<Road>& roads);
+
+  private:
+    HoughConfig m_config;
+};
+
+// batches on a work-stealing pool, one accumulator per worker (ProcessEvents)
+class ThreadedCpuBackend : public HoughBackend {
+  public:
+    ThreadedCpuBackend(const HoughConfig& config, unsigned nthreads) : m_config(config), m_pool(nthreads) {}
+    std::string name() const { return "threads"; }
+    void run(const EventStore& store, const std::vector<EventBatch>& batches, std::vector<Road>& roads);
+    void report(double seconds) const;
+
+  private:
+    HoughConfig m_config;
+    ThreadPool m_pool;
+};
+
+// "cpu" or "threads", throws for any other name (the OpenCL backend is built by host_openCL only)
+std::unique_ptr<HoughBackend> MakeCpuBackend(const std::string& name, const HoughConfig& config, unsigned nthreads);
+
+#endif
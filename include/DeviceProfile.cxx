@@ -0,0 +1,116 @@
+#include "DeviceProfile.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#ifndef DeviceProfile_cxx
+#define DeviceProfile_cxx
+
+using namespace std;
+
+static const char* commandNames[NDEVICE_COMMANDS] = { "host->device", "kernel", "counts->host", "device->host" };
+static const char* commandKeys[NDEVICE_COMMANDS] = { "write", "kernel", "counts", "read" }; // in the CSV
+
+#define LATENCY_BINS 24 // log2 bins of microseconds: < 1 us, [1, 2), [2, 4), ... and >= 2^22 us
+
+static int latencyBin(uint64_t ns) {
+  int bin = 0;
+  for (uint64_t us = ns/1000; us > 0 && bin < LATENCY_BINS-1; us >>= 1) bin++;
+  return bin;
+}
+
+void DeviceProfile::clear() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_commands.clear();
+}
+
+void DeviceProfile::add(const CommandTiming& timing) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_commands.push_back(timing);
+}
+
+double DeviceProfile::busy(DeviceCommand command) const {
+  uint64_t ns = 0;
+  for (size_t k = 0; k < m_commands.size(); ++k) {
+    if (m_commands[k].command == command) ns += m_commands[k].end - m_commands[k].start;
+  }
+  return 1e-9*ns;
+}
+
+double DeviceProfile::busy(DeviceCommand command, unsigned cu) const {
+  uint64_t ns = 0;
+  for (size_t k = 0; k < m_commands.size(); ++k) {
+    if (m_commands[k].command == command && m_commands[k].cu == cu) ns += m_commands[k].end - m_commands[k].start;
+  }
+  return 1e-9*ns;
+}
+
+void DeviceProfile::print(double seconds, unsigned ncu) const {
+
+  size_t count[NDEVICE_COMMANDS] = {0}, bytes[NDEVICE_COMMANDS] = {0}, nevents = 0;
+  uint64_t toSubmit[NDEVICE_COMMANDS] = {0}, toStart[NDEVICE_COMMANDS] = {0}, run[NDEVICE_COMMANDS] = {0};
+  size_t waitHist[NDEVICE_COMMANDS][LATENCY_BINS] = {{0}}, runHist[NDEVICE_COMMANDS][LATENCY_BINS] = {{0}};
+  int firstBin = LATENCY_BINS, lastBin = -1;
+  for (size_t k = 0; k < m_commands.size(); ++k) {
+    const CommandTiming& t = m_commands[k];
+    count[t.command]++;
+    bytes[t.command] += t.bytes;
+    toSubmit[t.command] += t.submit - t.queued; // in the runtime
+    toStart[t.command] += t.start - t.submit;   // on the device, behind the commands it depends on
+    run[t.command] += t.end - t.start;
+    if (t.command == COMMAND_KERNEL) nevents += t.nevents;
+    const int wait = latencyBin(t.start - t.queued), busy = latencyBin(t.end - t.start);
+    waitHist[t.command][wait]++;
+    runHist[t.command][busy]++;
+    firstBin = std::min(firstBin, std::min(wait, busy));
+    lastBin = std::max(lastBin, std::max(wait, busy));
+  }
+
+  printf(" device profile: %zu commands\n", m_commands.size());
+  printf(" %-14s %8s %10s %12s %12s %12s %12s %10s\n", "command", "count", "busy[s]", "submit[us]", "start[us]", "run[us]", "MB", "GB/s");
+  for (int c = 0; c < NDEVICE_COMMANDS; ++c) {
+    const double n = std::max<size_t>(1, count[c]);
+    printf(" %-14s %8zu %10.4f %12.1f %12.1f %12.1f", commandNames[c], count[c], 1e-9*run[c], 1e-3*toSubmit[c]/n, 1e-3*toStart[c]/n, 1e-3*run[c]/n);
+    if (c == COMMAND_KERNEL) printf(" %12s %10s\n", "-", "-");
+    else printf(" %12.2f %10.3f\n", 1e-6*bytes[c], run[c] ? (double) bytes[c]/run[c] : 0.);
+  }
+  printf(" kernel time per event: %.2f us (%zu events)\n", 1e-3*run[COMMAND_KERNEL]/std::max<size_t>(1, nevents), nevents);
+
+  // the transfers of all CUs share one PCIe link, the kernels run side by side on the CUs
+  const double link = 1e-9*(run[COMMAND_WRITE] + run[COMMAND_COUNTS] + run[COMMAND_READ])/seconds;
+  const double kernels = 1e-9*run[COMMAND_KERNEL]/(ncu*seconds);
+  printf(" PCIe link busy %.1f%%, kernels busy %.1f%% of %u CUs: %s-bound\n", 100*link, 100*kernels, ncu, link > kernels ? "PCIe" : "kernel");
+
+  if (lastBin < 0) return;
+  // queued -> start: waiting in the runtime and behind the previous commands; start -> end: on the device
+  printf(" %-14s", "latency [us]");
+  for (int c = 0; c < NDEVICE_COMMANDS; ++c) printf(" %21s", commandNames[c]);
+  printf("\n %-14s", "");
+  for (int c = 0; c < NDEVICE_COMMANDS; ++c) printf(" %10s %10s", "wait", "run");
+  printf("\n");
+  for (int b = firstBin; b <= lastBin; ++b) {
+    char label[48];
+    if (b == 0) snprintf(label, sizeof(label), "< 1");
+    else if (b == LATENCY_BINS-1) snprintf(label, sizeof(label), ">= %llu", 1ull << (b-1));
+    else snprintf(label, sizeof(label), "%llu - %llu", 1ull << (b-1), 1ull << b);
+    printf(" %-14s", label);
+    for (int c = 0; c < NDEVICE_COMMANDS; ++c) printf(" %10zu %10zu", waitHist[c][b], runHist[c][b]);
+    printf("\n");
+  }
+}
+
+void DeviceProfile::write(const std::string& fileName) const {
+  std::ofstream out(fileName.c_str());
+  if (!out) throw std::runtime_error("DeviceProfile: cannot create " + fileName);
+  uint64_t origin = UINT64_MAX;
+  for (size_t k = 0; k < m_commands.size(); ++k) origin = std::min(origin, m_commands[k].queued);
+  out << "command,cu,batch,nevents,bytes,queued,submit,start,end\n";
+  for (size_t k = 0; k < m_commands.size(); ++k) {
+    const CommandTiming& t = m_commands[k];
+    out << commandKeys[t.command] << ',' << t.cu << ',' << t.batch << ',' << t.nevents << ',' << t.bytes << ','
+        << t.queued - origin << ',' << t.submit - origin << ',' << t.start - origin << ',' << t.end - origin << '\n';
+  }
+  if (!out) throw std::runtime_error("DeviceProfile: error while writing " + fileName);
+}
+
+#endif
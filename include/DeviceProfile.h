@@ -0,0 +1,50 @@
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+#ifndef DeviceProfile_h
+#define DeviceProfile_h
+
+// ================================================
+// ================================================
+// Timestamps of the device commands of a run, from the OpenCL profiling info of their cl::Events
+// (CL_PROFILING_COMMAND_QUEUED/SUBMIT/START/END, in ns), kept free of OpenCL so that it builds everywhere.
+// print() sums them up per command: time on the device, bandwidth of the transfers, kernel time per
+// event, latency histograms, and whether the run is bound by PCIe or by the kernels. write() dumps one
+// CSV line per command for offline analysis.
+enum DeviceCommand { COMMAND_WRITE, COMMAND_KERNEL, COMMAND_COUNTS, COMMAND_READ, NDEVICE_COMMANDS };
+
+struct CommandTiming {
+  DeviceCommand command;
+  unsigned cu;
+  size_t batch;
+  size_t nevents;  // events of the batch
+  size_t bytes;    // moved over PCIe, 0 for the kernel
+  uint64_t queued, submit, start, end; // ns
+};
+
+class DeviceProfile {
+  public:
+    void clear();
+    // thread-safe, the commands come from every driver thread of the dispatcher
+    void add(const CommandTiming& timing);
+
+    size_t size() const { return m_commands.size(); }
+    // sum of end - start [s] of a command, over all CUs or on one
+    double busy(DeviceCommand command) const;
+    double busy(DeviceCommand command, unsigned cu) const;
+
+    // summary over a run of seconds on ncu compute units
+    void print(double seconds, unsigned ncu) const;
+    // CSV: command (write, kernel, counts, read),cu,batch,nevents,bytes,queued,submit,start,end with the times in ns from the first
+    // command queued; throws if the file cannot be written
+    void write(const std::string& fileName) const;
+
+  private:
+    std::mutex m_mutex;
+    std::vector<CommandTiming> m_commands;
+};
+
+#endif
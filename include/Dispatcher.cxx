@@ -0,0 +1,59 @@
+#include "Dispatcher.h"
+#include <chrono>
+#ifndef Dispatcher_cxx
+#define Dispatcher_cxx
+
+using namespace std;
+
+BatchDispatcher::BatchDispatcher(unsigned ncu, unsigned slotsPerCu) :
+  m_ncu(ncu ? ncu : 1), m_slots(slotsPerCu ? slotsPerCu : 1), m_batches(m_ncu, 0), m_busy(m_ncu, 0)
+{
+}
+
+void BatchDispatcher::run(size_t nbatches, const Process& process, std::vector<Road>& roads) {
+
+  std::vector<std::vector<Road>> batchRoads(nbatches);
+  std::vector<size_t> batches(m_ncu * m_slots, 0);
+  std::vector<double> busy(m_ncu * m_slots, 0);
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  std::mutex mutex;
+  std::exception_ptr error;
+
+  // thread d drives slot d % m_slots of CU d / m_slots
+  std::vector<std::thread> drivers;
+  for (unsigned d = 0; d < m_ncu * m_slots; ++d) {
+    drivers.push_back(std::thread([&, d]() {
+      while (!failed) {
+        const size_t batch = next++;
+        if (batch >= nbatches) return;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        try {
+          process(d / m_slots, d % m_slots, batch, batchRoads[batch]);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error) error = std::current_exception();
+          failed = true;
+        }
+        busy[d] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        batches[d]++;
+      }
+    }));
+  }
+  for (size_t d = 0; d < drivers.size(); ++d) drivers[d].join();
+  if (error) std::rethrow_exception(error);
+
+  for (unsigned cu = 0; cu < m_ncu; ++cu) {
+    m_batches[cu] = 0;
+    m_busy[cu] = 0;
+    for (unsigned s = 0; s < m_slots; ++s) {
+      m_batches[cu] += batches[cu * m_slots + s];
+      m_busy[cu] += busy[cu * m_slots + s];
+    }
+  }
+  for (size_t batch = 0; batch < nbatches; ++batch) {
+    roads.insert(roads.end(), std::make_move_iterator(batchRoads[batch].begin()), std::make_move_iterator(batchRoads[batch].end()));
+  }
+}
+
+#endif
@@ -0,0 +1,43 @@
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "HoughHelper.h"
+using namespace std;
+
+#ifndef Dispatcher_h
+#define Dispatcher_h
+
+// ================================================
+// ================================================
+// Hands the batches of a run to ncu compute units (kernel instances, each with its own DDR bank and queue).
+// Every CU is driven by slotsPerCu host threads, one per set of device buffers; a thread whose buffers are
+// free takes the next batch, so the CU that frees up first gets it and a faster or less loaded CU simply
+// takes more batches. process(cu, slot, batch, roads) runs on the thread of (cu, slot) and appends the roads
+// of the batch; the roads of all batches are merged in batch order, so the result does not depend on the
+// schedule. The dispatcher knows nothing about OpenCL: ./benchmark dispatch drives it with CPU threads
+// standing in for the CUs.
+class BatchDispatcher {
+  public:
+    typedef std::function<void(unsigned cu, unsigned slot, size_t batch, std::vector<Road>& roads)> Process;
+
+    BatchDispatcher(unsigned ncu, unsigned slotsPerCu);
+
+    unsigned nComputeUnits() const { return m_ncu; }
+    unsigned slotsPerCu() const { return m_slots; }
+    // rethrows the first exception of process, the batches not started yet are then skipped
+    void run(size_t nbatches, const Process& process, std::vector<Road>& roads);
+
+    // last run, per CU: batches it took and seconds its threads spent in process
+    size_t batchesOn(unsigned cu) const { return m_batches[cu]; }
+    double busyOn(unsigned cu) const { return m_busy[cu]; }
+
+  private:
+    unsigned m_ncu, m_slots;
+    std::vector<size_t> m_batches;
+    std::vector<double> m_busy;
+};
+
+#endif
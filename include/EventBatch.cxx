@@ -0,0 +1,78 @@
+#include "EventBatch.h"
+#ifndef EventBatch_cxx
+#define EventBatch_cxx
+
+using namespace std;
+
+std::vector<EventBatch> MakeBatches(const EventStore& store, size_t batchSize, size_t nevents) {
+  if (batchSize == 0) batchSize = 1;
+  if (nevents == 0 || nevents > store.nEvents()) nevents = store.nEvents();
+  std::vector<EventBatch> batches;
+  for (size_t first = 0; first < nevents; first += batchSize) {
+    EventBatch batch;
+    batch.first = first;
+    batch.nevents = std::min(batchSize, nevents - first);
+    batch.nhits = store.begin(first + batch.nevents) - store.begin(first);
+    batches.push_back(batch);
+  }
+  return batches;
+}
+
+size_t MaxBatchHits(const std::vector<EventBatch>& batches) {
+  size_t nhits = 0;
+  for (size_t i = 0; i < batches.size(); ++i) nhits = std::max(nhits, batches[i].nhits);
+  return nhits;
+}
+
+void PackEventBatch(const EventStore& store, const EventBatch& batch, WireHit* hits, uint32_t* offsets) {
+  const size_t base = store.begin(batch.first);
+  for (size_t k = 0; k < batch.nevents; ++k) offsets[k] = store.begin(batch.first + k) - base;
+  offsets[batch.nevents] = batch.nhits;
+
+  for (size_t i = 0; i < batch.nhits; ++i) {
+    const size_t j = base + i;
+    const int32_t layer = store.layer()[j];
+    if (layer < INT16_MIN || layer > INT16_MAX) throw std::runtime_error("PackEventBatch: layer " + std::to_string(layer) + " does not fit the wire format");
+    hits[i].r = store.r()[j];
+    hits[i].x = store.x()[j];
+    hits[i].y = store.y()[j];
+    hits[i].z = store.z()[j];
+    hits[i].layer = layer;
+    hits[i].flags = 0;
+  }
+}
+
+EventStore UnpackEventHits(const EventStore& store, size_t event, const WireHit* hits, size_t nhits) {
+  EventColumns cols;
+  cols.offsets.push_back(0);
+  cols.charge.push_back(store.charge(event)); cols.pt.push_back(store.pt(event)); cols.d0.push_back(store.d0(event));
+  for (size_t i = 0; i < nhits; ++i) {
+    cols.layer.push_back(hits[i].layer);
+    cols.r.push_back(hits[i].r); cols.x.push_back(hits[i].x); cols.y.push_back(hits[i].y); cols.z.push_back(hits[i].z);
+  }
+  cols.offsets.push_back(cols.layer.size());
+  return EventStore(std::move(cols));
+}
+
+void print_info_wire_hits(const WireHit* hits, size_t nhits) {
+  for (size_t i = 0; i < nhits; i++) {
+    std::cout << " layer " << hits[i].layer
+              << " r " << hits[i].r
+              << " x " << hits[i].x
+              << " y " << hits[i].y
+              << " z " << hits[i].z
+              << std::endl;
+  }
+}
+
+size_t BlockBatchBytes(const EventBatch& batch) {
+  // input blocks, zeroed output blocks (the kernel only wrote the hits it kept), output blocks back, offsets
+  return 3 * 9 * sizeof(double) * batch.nhits + sizeof(uint32_t) * (batch.nevents + 1);
+}
+
+size_t WireBatchBytes(const EventBatch& batch, size_t outputBytes) {
+  // input hits and offsets, counts and the packed output back
+  return sizeof(WireHit) * batch.nhits + outputBytes + 2 * sizeof(uint32_t) * (batch.nevents + 1);
+}
+
+#endif
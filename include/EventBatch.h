@@ -0,0 +1,39 @@
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "EventStore.h"
+#include "WireFormat.h"
+using namespace std;
+
+#ifndef EventBatch_h
+#define EventBatch_h
+
+// ================================================
+// ================================================
+// Events sent to the tk kernel in one invocation.
+// The hits of events [first, first+nevents) are packed back to back as WireHits (include/WireFormat.h);
+// event k of the batch owns the hits [offsets[k], offsets[k+1]). The kernel sends back the hits it keeps
+// packed the same way, with its own table counts[k] (counts[nevents] hits in all).
+struct EventBatch {
+  size_t first;   // first event of the batch in the store
+  size_t nevents;
+  size_t nhits;   // hits in the batch
+};
+
+// consecutive batches of batchSize events (the last one may be shorter) over the first nevents events, 0 for all
+std::vector<EventBatch> MakeBatches(const EventStore& store, size_t batchSize, size_t nevents = 0);
+// largest nhits of the batches, i.e. the size the device buffers need
+size_t MaxBatchHits(const std::vector<EventBatch>& batches);
+// hits needs batch.nhits entries, offsets batch.nevents+1; throws if a layer does not fit the int16 of the wire
+void PackEventBatch(const EventStore& store, const EventBatch& batch, WireHit* hits, uint32_t* offsets);
+// one-event store with the nhits hits the kernel kept for event (its slice of the packed output), truth from store
+EventStore UnpackEventHits(const EventStore& store, size_t event, const WireHit* hits, size_t nhits);
+void print_info_wire_hits(const WireHit* hits, size_t nhits);
+
+// bytes over PCIe for a batch, both directions: with the numhits..d0 blocks of doubles read back in full,
+// and with WireHits where only the used outputBytes of the packed output (kept hits or roads) come back
+size_t BlockBatchBytes(const EventBatch& batch);
+size_t WireBatchBytes(const EventBatch& batch, size_t outputBytes);
+
+#endif
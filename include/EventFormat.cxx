@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "EventFormat.h"
+#ifndef EventFormat_cxx
+#define EventFormat_cxx
+
+using namespace std;
+
+// ================================================
+// ================================================
+// Memory mapped reader
+MappedEventFile::MappedEventFile(const string& fileName) : m_base(NULL), m_size(0), m_header(NULL) {
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("MappedEventFile: cannot open " + fileName);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(EventFileHeader)) {
+    close(fd);
+    throw std::runtime_error("MappedEventFile: " + fileName + " is too small to be an event file");
+  }
+  m_size = st.st_size;
+
+  void* base = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping keeps its own reference
+  if (base == MAP_FAILED) throw std::runtime_error("MappedEventFile: cannot map " + fileName);
+  m_base = static_cast<const char*>(base);
+  m_header = reinterpret_cast<const EventFileHeader*>(m_base);
+
+  std::string error;
+  if (std::memcmp(m_header->magic, EVENTFILE_MAGIC, 4) != 0) error = " has no event file magic";
+  else if (m_header->version != EVENTFILE_VERSION) error = " has an unsupported event file version";
+  else if (m_header->nevents >= m_size/sizeof(uint64_t) || m_header->nhits > m_size/sizeof(float)) error = " is truncated";
+  else { // counts below m_size, so the lengths cannot overflow
+    const uint64_t length[NCOLUMNS] = { (m_header->nevents+1)*sizeof(uint64_t),
+      m_header->nhits*sizeof(int32_t), m_header->nhits*sizeof(float), m_header->nhits*sizeof(float),
+      m_header->nhits*sizeof(float), m_header->nhits*sizeof(float), m_header->nevents*sizeof(float),
+      m_header->nevents*sizeof(float), m_header->nevents*sizeof(float) };
+    for (int col = 0; col < NCOLUMNS; ++col) {
+      const uint64_t column = m_header->column[col];
+      if (column > m_size || length[col] > m_size - column) { error = " is truncated"; break; }
+    }
+    // every event's [offsets[e], offsets[e+1]) must lie inside the hit columns
+    const uint64_t* offset = error.empty() ? offsets() : NULL;
+    if (offset && (offset[0] != 0 || offset[m_header->nevents] != m_header->nhits)) error = " has an inconsistent offset table";
+    for (uint64_t e = 0; error.empty() && e < m_header->nevents; ++e) {
+      if (offset[e+1] < offset[e]) error = " has a decreasing offset table";
+    }
+  }
+  if (!error.empty()) {
+    munmap(const_cast<char*>(m_base), m_size);
+    throw std::runtime_error("MappedEventFile: " + fileName + error);
+  }
+  madvise(const_cast<char*>(m_base), m_size, MADV_WILLNEED);
+}
+
+MappedEventFile::~MappedEventFile() {
+  if (m_base) munmap(const_cast<char*>(m_base), m_size);
+}
+
+bool IsEventFile(const string& fileName) {
+  char magic[4] = {0, 0, 0, 0};
+  std::ifstream file(fileName.c_str(), std::ifstream::binary);
+  file.read(magic, 4);
+  return file.gcount() == 4 && std::memcmp(magic, EVENTFILE_MAGIC, 4) == 0;
+}
+
+// ================================================
+// ================================================
+// Writer
+template <typename T>
+static void writeColumn(std::ofstream& out, uint64_t pos, const T* data, size_t n) {
+  static const char zeros[64] = {0};
+  while ((uint64_t) out.tellp() < pos) out.write(zeros, std::min<uint64_t>(64, pos - out.tellp()));
+  out.write(reinterpret_cast<const char*>(data), n*sizeof(T));
+}
+
+void WriteEventFile(const string& fileName, const EventColumns& cols) {
+  EventFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, EVENTFILE_MAGIC, 4);
+  header.version = EVENTFILE_VERSION;
+  header.nevents = cols.nEvents();
+  header.nhits = cols.nHits();
+
+  const uint64_t length[NCOLUMNS] = { cols.offsets.size()*sizeof(uint64_t),
+    header.nhits*sizeof(int32_t), header.nhits*sizeof(float), header.nhits*sizeof(float),
+    header.nhits*sizeof(float), header.nhits*sizeof(float), header.nevents*sizeof(float),
+    header.nevents*sizeof(float), header.nevents*sizeof(float) };
+  uint64_t pos = sizeof(EventFileHeader);
+  for (int col = 0; col < NCOLUMNS; ++col) {
+    pos = (pos + 63) & ~uint64_t(63);
+    header.column[col] = pos;
+    pos += length[col];
+  }
+
+  std::ofstream out(fileName.c_str(), std::ofstream::binary | std::ofstream::trunc);
+  if (!out) throw std::runtime_error("WriteEventFile: cannot create " + fileName);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  writeColumn(out, header.column[COL_OFFSETS], cols.offsets.data(), cols.offsets.size());
+  writeColumn(out, header.column[COL_LAYER], cols.layer.data(), cols.layer.size());
+  writeColumn(out, header.column[COL_R], cols.r.data(), cols.r.size());
+  writeColumn(out, header.column[COL_X], cols.x.data(), cols.x.size());
+  writeColumn(out, header.column[COL_Y], cols.y.data(), cols.y.size());
+  writeColumn(out, header.column[COL_Z], cols.z.data(), cols.z.size());
+  writeColumn(out, header.column[COL_CHARGE], cols.charge.data(), cols.charge.size());
+  writeColumn(out, header.column[COL_PT], cols.pt.data(), cols.pt.size());
+  writeColumn(out, header.column[COL_D0], cols.d0.data(), cols.d0.size());
+  if (!out) throw std::runtime_error("WriteEventFile: error while writing " + fileName);
+}
+
+#endif
@@ -0,0 +1,83 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+using namespace std;
+
+#ifndef EventFormat_h
+#define EventFormat_h
+
+// ================================================
+// ================================================
+// Binary columnar event file (".htev")
+//
+// Layout, all little-endian:
+//   EventFileHeader
+//   offsets  uint64_t[nevents+1]   hits of event e are [offsets[e], offsets[e+1])
+//   layer    int32_t[nhits]
+//   r,x,y,z  float[nhits]          one column each
+//   charge, pt, d0  float[nevents] truth, stored once per event
+// Every column starts on a 64-byte boundary so it can be used straight from the mapping.
+#define EVENTFILE_MAGIC "HTEV"
+#define EVENTFILE_VERSION 1
+
+enum EventColumn {
+  COL_OFFSETS = 0, COL_LAYER, COL_R, COL_X, COL_Y, COL_Z, COL_CHARGE, COL_PT, COL_D0, NCOLUMNS
+};
+
+struct EventFileHeader {
+  char     magic[4];          // EVENTFILE_MAGIC
+  uint32_t version;           // EVENTFILE_VERSION
+  uint64_t nevents;
+  uint64_t nhits;
+  uint64_t column[NCOLUMNS];  // byte position of each column from the start of the file
+};
+
+// In-memory columns, same layout as the file (filled by ParseMergeText)
+struct EventColumns {
+  std::vector<uint64_t> offsets;
+  std::vector<int32_t> layer;
+  std::vector<float> r, x, y, z;
+  std::vector<float> charge, pt, d0;
+
+  size_t nEvents() const { return offsets.empty() ? 0 : offsets.size()-1; }
+  size_t nHits() const { return layer.size(); }
+};
+
+// Read-only memory mapping of an event file, no copy and no parsing
+class MappedEventFile {
+  public:
+    explicit MappedEventFile(const string& fileName);
+    ~MappedEventFile();
+
+    size_t nEvents() const { return m_header->nevents; }
+    size_t nHits() const { return m_header->nhits; }
+    size_t nHits(size_t event) const { return offsets()[event+1] - offsets()[event]; }
+
+    const uint64_t* offsets() const { return column<uint64_t>(COL_OFFSETS); }
+    const int32_t* layer() const { return column<int32_t>(COL_LAYER); }
+    const float* r() const { return column<float>(COL_R); }
+    const float* x() const { return column<float>(COL_X); }
+    const float* y() const { return column<float>(COL_Y); }
+    const float* z() const { return column<float>(COL_Z); }
+    const float* charge() const { return column<float>(COL_CHARGE); }
+    const float* pt() const { return column<float>(COL_PT); }
+    const float* d0() const { return column<float>(COL_D0); }
+
+  private:
+    MappedEventFile(const MappedEventFile&);
+    MappedEventFile& operator=(const MappedEventFile&);
+
+    template <typename T>
+    const T* column(EventColumn col) const { return reinterpret_cast<const T*>(m_base + m_header->column[col]); }
+
+    const char* m_base;
+    size_t m_size;
+    const EventFileHeader* m_header;
+};
+
+bool IsEventFile(const string& fileName);
+void WriteEventFile(const string& fileName, const EventColumns& cols);
+
+#endif
@@ -0,0 +1,97 @@
+#include <iostream>
+#include "EventStore.h"
+#include "MergeParser.h"
+#ifndef EventStore_cxx
+#define EventStore_cxx
+
+using namespace std;
+
+EventStore::EventStore() {
+  m_owned.offsets.push_back(0);
+  bind();
+}
+
+EventStore::EventStore(const EventColumns& cols) : m_owned(cols) {
+  if (m_owned.offsets.empty()) m_owned.offsets.push_back(0);
+  bind();
+}
+
+EventStore::EventStore(EventColumns&& cols) : m_owned(std::move(cols)) {
+  if (m_owned.offsets.empty()) m_owned.offsets.push_back(0);
+  bind();
+}
+
+EventStore::EventStore(std::shared_ptr<const MappedEventFile> file) : m_file(file) {
+  bind();
+}
+
+EventStore::EventStore(const EventStore& other) : m_owned(other.m_owned), m_file(other.m_file) {
+  bind();
+}
+
+EventStore::EventStore(EventStore&& other) : m_owned(std::move(other.m_owned)), m_file(std::move(other.m_file)) {
+  bind();
+  other.m_owned = EventColumns();
+  other.m_owned.offsets.push_back(0);
+  other.bind();
+}
+
+EventStore& EventStore::operator=(const EventStore& other) {
+  if (this != &other) {
+    m_owned = other.m_owned;
+    m_file = other.m_file;
+    bind();
+  }
+  return *this;
+}
+
+EventStore& EventStore::operator=(EventStore&& other) {
+  if (this != &other) {
+    m_owned = std::move(other.m_owned);
+    m_file = std::move(other.m_file);
+    bind();
+    other.m_owned = EventColumns();
+    other.m_owned.offsets.push_back(0);
+    other.bind();
+  }
+  return *this;
+}
+
+// point the column pointers at whichever storage holds the data
+void EventStore::bind() {
+  if (m_file) {
+    m_nevents = m_file->nEvents(); m_nhits = m_file->nHits();
+    m_offsets = m_file->offsets(); m_layer = m_file->layer();
+    m_r = m_file->r(); m_x = m_file->x(); m_y = m_file->y(); m_z = m_file->z();
+    m_charge = m_file->charge(); m_pt = m_file->pt(); m_d0 = m_file->d0();
+  } else {
+    m_nevents = m_owned.nEvents(); m_nhits = m_owned.nHits();
+    m_offsets = m_owned.offsets.data(); m_layer = m_owned.layer.data();
+    m_r = m_owned.r.data(); m_x = m_owned.x.data(); m_y = m_owned.y.data(); m_z = m_owned.z.data();
+    m_charge = m_owned.charge.data(); m_pt = m_owned.pt.data(); m_d0 = m_owned.d0.data();
+  }
+}
+
+EventStore LoadEventStore(const string& fileName, unsigned nthreads) {
+  if (IsEventFile(fileName)) return EventStore(std::make_shared<const MappedEventFile>(fileName));
+
+  EventColumns cols;
+  ParseMergeText(fileName, cols, nthreads);
+  return EventStore(std::move(cols));
+}
+
+void print_info_event_store(const EventStore& store, size_t nevents){
+
+  for(size_t i=0; i<nevents && i<store.nEvents(); i++){
+    std::cout << " eventNumber: #" << i<< std::endl;
+    for(size_t j=store.begin(i); j<store.end(i); j++){
+      std::cout << " " << store.nHits(i) << "  " << store.layer()[j] << "  " << store.r()[j] << "  " << store.x()[j]
+                << "  " << store.y()[j] << "  " << store.z()[j] << "  " << store.charge(i) << "  " << store.pt(i)
+                << "  " << store.d0(i) << " ";
+    }
+    std::cout << std::endl;
+    std::cout << " ============================== " << std::endl;
+  }
+}
+
+#endif
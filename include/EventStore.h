@@ -0,0 +1,61 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include "EventFormat.h"
+using namespace std;
+
+#ifndef EventStore_h
+#define EventStore_h
+
+// ================================================
+// ================================================
+// Structure-of-arrays hit store shared by SelectEvents, HoughTransform and the host.
+// Hits are contiguous columns (layer, r, x, y, z), truth is kept once per event and
+// event e owns the hit range [begin(e), end(e)) of the CSR offset table.
+// The columns either live in the store or in a mapped event file.
+class EventStore {
+  public:
+    EventStore();
+    explicit EventStore(const EventColumns& cols);
+    explicit EventStore(EventColumns&& cols);
+    explicit EventStore(std::shared_ptr<const MappedEventFile> file);
+    EventStore(const EventStore& other);
+    EventStore(EventStore&& other);
+    EventStore& operator=(const EventStore& other);
+    EventStore& operator=(EventStore&& other);
+
+    size_t nEvents() const { return m_nevents; }
+    size_t nHits() const { return m_nhits; }
+    size_t nHits(size_t event) const { return m_offsets[event+1] - m_offsets[event]; }
+    size_t begin(size_t event) const { return m_offsets[event]; }
+    size_t end(size_t event) const { return m_offsets[event+1]; }
+
+    const uint64_t* offsets() const { return m_offsets; }
+    const int32_t* layer() const { return m_layer; }
+    const float* r() const { return m_r; }
+    const float* x() const { return m_x; }
+    const float* y() const { return m_y; }
+    const float* z() const { return m_z; }
+
+    float charge(size_t event) const { return m_charge[event]; }
+    float pt(size_t event) const { return m_pt[event]; }
+    float d0(size_t event) const { return m_d0[event]; }
+
+  private:
+    void bind();
+
+    EventColumns m_owned;
+    std::shared_ptr<const MappedEventFile> m_file;
+
+    size_t m_nevents, m_nhits;
+    const uint64_t* m_offsets;
+    const int32_t* m_layer;
+    const float *m_r, *m_x, *m_y, *m_z;
+    const float *m_charge, *m_pt, *m_d0;
+};
+
+// Reads a binary event file (mapped) or a merged text file (parsed on nthreads)
+EventStore LoadEventStore(const string& fileName, unsigned nthreads);
+void print_info_event_store(const EventStore& store, size_t nevents);
+
+#endif
@@ -0,0 +1,74 @@
+#include <cmath>
+#include <cstdint>
+using namespace std;
+
+#ifndef FixedPoint_h
+#define FixedPoint_h
+
+// ================================================
+// ================================================
+// Signed fixed-point number with IntBits integer and FracBits fraction bits in an int64, the arithmetic an
+// ap_fixed<IntBits+FracBits+1, IntBits+1, AP_TRN, AP_SAT> does on the FPGA: results are truncated towards
+// -infinity and saturate at the largest magnitude instead of wrapping. Products and quotients go through
+// 128-bit intermediates and sqrt is the exact integer square root, so nothing is computed in floating
+// point. Used as the row type of HoughEngine (include/HoughEngine.h) to measure what the card would lose.
+template <int IntBits, int FracBits>
+class Fixed {
+  static_assert(IntBits > 0 && FracBits >= 0 && IntBits + FracBits <= 62, "Fixed: the value and its sign must fit 64 bits");
+
+  public:
+    static constexpr int64_t one = int64_t(1) << FracBits;
+    static constexpr int64_t maxRaw = (int64_t(1) << (IntBits + FracBits)) - 1;
+
+    Fixed() : m_raw(0) {}
+    Fixed(double value) : m_raw(0) { // quantized with truncation, saturated
+      const double scaled = std::floor(value * one);
+      if (std::isnan(scaled)) m_raw = 0;
+      else if (scaled >= (double) maxRaw) m_raw = maxRaw;
+      else if (scaled <= (double) -maxRaw) m_raw = -maxRaw;
+      else m_raw = (int64_t) scaled;
+    }
+
+    static Fixed fromRaw(__int128 raw) {
+      Fixed f;
+      f.m_raw = raw > maxRaw ? maxRaw : (raw < -maxRaw ? -maxRaw : (int64_t) raw);
+      return f;
+    }
+    int64_t raw() const { return m_raw; }
+
+    friend double ToDouble(Fixed a) { return (double) a.m_raw / one; }
+
+    friend Fixed operator+(Fixed a, Fixed b) { return fromRaw((__int128) a.m_raw + b.m_raw); }
+    friend Fixed operator-(Fixed a, Fixed b) { return fromRaw((__int128) a.m_raw - b.m_raw); }
+    friend Fixed operator-(Fixed a) { return fromRaw(-(__int128) a.m_raw); }
+    friend Fixed operator*(Fixed a, Fixed b) { return fromRaw(((__int128) a.m_raw * b.m_raw) >> FracBits); }
+    friend Fixed operator/(Fixed a, Fixed b) {
+      if (b.m_raw == 0) return fromRaw(a.m_raw < 0 ? -(__int128) maxRaw : (__int128) maxRaw);
+      const __int128 n = (__int128) a.m_raw * one, q = n / b.m_raw;
+      return fromRaw((q * b.m_raw != n && ((n < 0) != (b.m_raw < 0))) ? q - 1 : q); // floor, like the shifts
+    }
+    // 0 for negative arguments (the callers test R2 > h2 first)
+    friend Fixed sqrt(Fixed a) {
+      if (a.m_raw <= 0) return Fixed();
+      const unsigned __int128 n = (unsigned __int128) a.m_raw << FracBits; // sqrt(raw/2^F) * 2^F = sqrt(raw * 2^F)
+      uint64_t s = (uint64_t) std::sqrt((double) n);
+      while ((unsigned __int128) s * s > n) s--;
+      while ((unsigned __int128) (s + 1) * (s + 1) <= n) s++;
+      return fromRaw(s);
+    }
+
+    friend bool operator<(Fixed a, Fixed b) { return a.m_raw < b.m_raw; }
+    friend bool operator>(Fixed a, Fixed b) { return a.m_raw > b.m_raw; }
+    friend bool operator<=(Fixed a, Fixed b) { return a.m_raw <= b.m_raw; }
+    friend bool operator>=(Fixed a, Fixed b) { return a.m_raw >= b.m_raw; }
+    friend bool operator==(Fixed a, Fixed b) { return a.m_raw == b.m_raw; }
+    friend bool operator!=(Fixed a, Fixed b) { return a.m_raw != b.m_raw; }
+
+  private:
+    int64_t m_raw;
+};
+
+inline double ToDouble(double value) { return value; }
+inline double ToDouble(float value) { return value; }
+
+#endif
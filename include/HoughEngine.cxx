@@ -0,0 +1,98 @@
+#include "HoughEngine.h"
+#include <stdexcept>
+#ifndef HoughEngine_cxx
+#define HoughEngine_cxx
+
+using namespace std;
+
+// the HoughConfig defaults
+struct Hough216 {
+  static constexpr int sizeX = 216, sizeY = 216;
+  static constexpr float d0Range = 120, qOverPtRange = 0.002;
+  static constexpr bool continuous = true;
+  typedef double fp;
+};
+
+// the same with single-precision rows
+struct Hough216Float : Hough216 {
+  typedef float fp;
+};
+
+// fixed-point rows: R2 reaches 3.2e10 mm^2 in the central q/pT rows, so 36 integer bits, and the
+// fraction bits set the resolution of the terms (2^-12 mm^2 is well below a d0 bin)
+struct Hough216Fixed20 : Hough216 {
+  typedef Fixed<36, 20> fp;
+};
+
+struct Hough216Fixed12 : Hough216 {
+  typedef Fixed<36, 12> fp;
+};
+
+struct Hough216Fixed6 : Hough216 {
+  typedef Fixed<36, 6> fp;
+};
+
+// coarser and finer binnings over the same ranges
+struct Hough108 : Hough216 {
+  static constexpr int sizeX = 108, sizeY = 108;
+};
+
+struct Hough432 : Hough216 {
+  static constexpr int sizeX = 432, sizeY = 432;
+};
+
+// one bin per row, no interpolation between rows
+struct Hough216Discrete : Hough216 {
+  static constexpr bool continuous = false;
+};
+
+std::vector<std::string> HoughEngineNames(){
+  return { "216x216", "216x216-float", "216x216-fixed36.20", "216x216-fixed36.12", "216x216-fixed36.6",
+           "108x108", "432x432", "216x216-discrete" };
+}
+
+std::unique_ptr<HoughEngineBase> MakeHoughEngine(const std::string& name, const HoughConfig& base){
+  if (name == "216x216") return std::unique_ptr<HoughEngineBase>(new HoughEngine<Hough216>(name, base));
+  if (name == "216x216-float") return std::unique_ptr<HoughEngineBase>(new HoughEngine<Hough216Float>(name, base));
+  if (name == "216x216-fixed36.20") return std::unique_ptr<HoughEngineBase>(new HoughEngine<Hough216Fixed20>(name, base));
+  if (name == "216x216-fixed36.12") return std::unique_ptr<HoughEngineBase>(new HoughEngine<Hough216Fixed12>(name, base));
+  if (name == "216x216-fixed36.6") return std::unique_ptr<HoughEngineBase>(new HoughEngine<Hough216Fixed6>(name, base));
+  if (name == "108x108") return std::unique_ptr<HoughEngineBase>(new HoughEngine<Hough108>(name, base));
+  if (name == "432x432") return std::unique_ptr<HoughEngineBase>(new HoughEngine<Hough432>(name, base));
+  if (name == "216x216-discrete") return std::unique_ptr<HoughEngineBase>(new HoughEngine<Hough216Discrete>(name, base));
+  throw std::runtime_error("MakeHoughEngine: no engine " + name);
+}
+
+static const char* const precisionNames[] = { "double", "float", "fixed36.20", "fixed36.12", "fixed36.6" };
+
+std::string PrecisionName(HoughPrecision precision){
+  return precisionNames[precision];
+}
+
+HoughPrecision ParsePrecision(const std::string& name){
+  for (int p = PRECISION_DOUBLE; p <= PRECISION_FIXED6; ++p) {
+    if (name == precisionNames[p]) return HoughPrecision(p);
+  }
+  throw std::invalid_argument("unknown precision " + name + " (double, float, fixed36.20, fixed36.12, fixed36.6)");
+}
+
+void HoughEventPrecision(const EventStore& store, size_t event, const HoughConfig& config, HoughImage& image, std::vector<Road>& roads){
+
+  static thread_local std::unique_ptr<HoughEngineBase> engines[PRECISION_FIXED6 + 1];
+  std::unique_ptr<HoughEngineBase>& engine = engines[config.m_precision];
+  if (!engine) engine = MakeHoughEngine(config.m_precision == PRECISION_DOUBLE ? "216x216" : "216x216-" + PrecisionName(config.m_precision), config);
+  else engine->configure(config);
+
+  const HoughConfig& fixed = engine->config();
+  if (config.m_imageSize_x != fixed.m_imageSize_x || config.m_imageSize_y != fixed.m_imageSize_y ||
+      config.m_d0_range != fixed.m_d0_range || config.m_qOverPt_range != fixed.m_qOverPt_range ||
+      config.m_continuous != fixed.m_continuous) {
+    throw std::invalid_argument("HoughEvent: precision " + PrecisionName(config.m_precision) + " is compiled for the " + engine->name() + " image only");
+  }
+  if (config.m_phiSectors > 1 || config.m_coarseFactor > 1) {
+    throw std::invalid_argument("HoughEvent: precision " + PrecisionName(config.m_precision) + " has no phi sectors or coarse-to-fine search");
+  }
+  engine->event(store, event, image, roads);
+}
+
+#endif
@@ -0,0 +1,157 @@
+#include <array>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FixedPoint.h"
+#include "HoughHelper.h"
+using namespace std;
+
+#ifndef HoughEngine_h
+#define HoughEngine_h
+
+// ================================================
+// ================================================
+// Doublet Hough transform specialised at compile time. Config fixes what HoughConfig leaves to runtime:
+//   struct Config {
+//     static constexpr int sizeX, sizeY;             // d0 and q/pT bins
+//     static constexpr float d0Range, qOverPtRange;  // float as in HoughConfig, so the steps round the same way
+//     static constexpr bool continuous;              // m_continuous
+//     typedef double fp;                             // arithmetic of the doublet terms and the row loop:
+//   };                                               // double, float or Fixed<IntBits, FracBits>
+// The row loop then has a constant trip count, the accumulator a constant stride, the fill mode is
+// resolved by the compiler and the d0 -> bin division is a multiplication by a constant. The pair cut,
+// thresholds, peak finding and m_collectHits are the runtime ones of the base configuration, so event()
+// finds the roads of HoughEvent(store, event, config(), ...); ./benchmark engine checks them road for road.
+// With a float or fixed-point fp the row table is quantized from double (the ROM of the card) and the
+// doublet terms and rows are computed in fp; ./benchmark precision reports what that costs against double.
+class HoughEngineBase {
+  public:
+    virtual ~HoughEngineBase() {}
+    virtual std::string name() const = 0;
+    // the runtime configuration with the same parameters
+    virtual const HoughConfig& config() const = 0;
+    // take the runtime parameters of base, as the constructor does, keeping the binning of the engine
+    virtual void configure(const HoughConfig& base) = 0;
+    // fill + roads of one event, the image is resized or cleared first
+    virtual void event(const EventStore& store, size_t event, HoughImage& image, std::vector<Road>& roads) const = 0;
+};
+
+template <typename Config>
+class HoughEngine : public HoughEngineBase {
+  public:
+    typedef typename Config::fp fp;
+    static constexpr int sizeX = Config::sizeX;
+    static constexpr int sizeY = Config::sizeY;
+    static constexpr double stepX = (2*Config::d0Range) / sizeX; // float arithmetic, as HoughConfig::stepX
+    static constexpr double stepY = (2*Config::qOverPtRange) / sizeY;
+    static constexpr double invStepX = 1 / stepX;
+
+    // base: the runtime parameters, its binning, ranges and fill mode are replaced by the ones of Config
+    HoughEngine(const std::string& name, const HoughConfig& base);
+    std::string name() const { return m_name; }
+    const HoughConfig& config() const { return m_config; }
+    void configure(const HoughConfig& base);
+    void event(const EventStore& store, size_t event, HoughImage& image, std::vector<Road>& roads) const;
+
+  private:
+    void rowBins(fp A, fp B, fp h2, int* __restrict xbins) const;
+    void fill(const Doublet& doublet, HoughCount* __restrict bins) const;
+
+    std::string m_name;
+    HoughConfig m_config;
+    std::array<fp, sizeY> m_radius2, m_absRadius, m_sign; // HoughRowTable
+};
+
+template <typename Config>
+HoughEngine<Config>::HoughEngine(const std::string& name, const HoughConfig& base) : m_name(name) {
+  configure(base);
+  for (int y = 0; y < sizeY; y++) {
+    const double qoverpt = -1.*( (y * stepY) + stepY*0.5 - Config::qOverPtRange);
+    const double radius = 1.0/(0.6*qoverpt);
+    m_radius2[y] = fp(radius*radius);
+    m_absRadius[y] = fp(std::abs(radius));
+    m_sign[y] = fp(std::signbit(radius) ? -1.0 : 1.0);
+  }
+}
+
+template <typename Config>
+void HoughEngine<Config>::configure(const HoughConfig& base) {
+  m_config = base;
+  m_config.m_imageSize_x = sizeX;
+  m_config.m_imageSize_y = sizeY;
+  m_config.m_d0_range = Config::d0Range;
+  m_config.m_qOverPt_range = Config::qOverPtRange;
+  m_config.m_continuous = Config::continuous;
+  m_config.m_precision = PRECISION_DOUBLE; // the fp of the engine, not the runtime one
+}
+
+// d0 bin of every row, -1 outside the image: the D0_TABLE row loop without branches, so that with its
+// constant trip count the compiler vectorizes it. Rows with no circle through both hits take the sqrt
+// of a negative number, the NaN fails the bin test like in DoubletBinsRows. A Fixed fp has no NaN and
+// no vectors, its rows are rejected by the R2 > h2 test alone.
+template <typename Config>
+__attribute__((target_clones("avx2", "default"), optimize("tree-vectorize", "vect-cost-model=dynamic")))
+void HoughEngine<Config>::rowBins(fp A, fp B, fp h2, int* __restrict xbins) const {
+  using std::sqrt;
+  for (int y = 1; y < sizeY; y++) {
+    const fp R2 = m_radius2[y];
+    const fp t = m_sign[y]*B*sqrt(R2 - h2);
+    const fp d0 = m_sign[y]*(A + t)/(sqrt(A + R2 + t) + m_absRadius[y]);
+    const double xd = (ToDouble(d0) + Config::d0Range) * invStepX;
+    const bool inside = (R2 > h2) & (1 <= xd) & (xd < sizeX);
+    const int x = int(inside ? xd : 0.);
+    xbins[y] = inside ? x : -1;
+  }
+}
+
+// the fill of walkDoublet, with the fill mode resolved at compile time and GetDoubletTerms done in fp
+template <typename Config>
+void HoughEngine<Config>::fill(const Doublet& doublet, HoughCount* __restrict bins) const {
+  using std::sqrt;
+  const fp hx = fp(doublet.half[0]), hy = fp(doublet.half[1]);
+  const fp mx = fp(doublet.mid[0]), my = fp(doublet.mid[1]);
+  const fp h2 = hx*hx + hy*hy;
+  const fp A = mx*mx + my*my - h2;
+  const fp B = fp(2)*(my*hx - mx*hy) / sqrt(h2);
+  int xbins[sizeY];
+  rowBins(A, B, h2, xbins);
+  int xbefore = -1;
+  for (int y = 1; y < sizeY; y++) {
+    const int x = xbins[y];
+    if (x < 0) continue;
+    if (xbefore == -1) xbefore = x;
+    int xmin = x, xmax = x;
+    if constexpr (Config::continuous) {
+      xmin = (xbefore < x) ? xbefore : x;
+      xmax = (xbefore < x) ? x : xbefore;
+    }
+    for (int xi = xmin; xi <= xmax; ++xi) {
+      HoughCount& count = bins[xi*sizeY + y];
+      if (count != HOUGHCOUNT_MAX) count++;
+    }
+    xbefore = x;
+  }
+}
+
+template <typename Config>
+void HoughEngine<Config>::event(const EventStore& store, size_t event, HoughImage& image, std::vector<Road>& roads) const {
+  if (image.size(0) != (size_t) sizeX || image.size(1) != (size_t) sizeY) image = HoughImage(sizeX, sizeY);
+  else image.fill();
+
+  static thread_local std::vector<Doublet> doublets;
+  MakeDoublets(store, event, store.begin(event), store.end(event), m_config, doublets);
+  HoughCount* bins = image[0];
+  for (size_t d = 0; d < doublets.size(); ++d) fill(doublets[d], bins);
+
+  const size_t firstRoad = roads.size();
+  FindRoads(image, event, m_config, roads);
+  if (m_config.m_collectHits) CollectRoadHits(store, event, m_config, roads, firstRoad);
+}
+
+// the instantiations compiled in (include/HoughEngine.cxx), by name
+std::vector<std::string> HoughEngineNames();
+// throws for a name that is not compiled in
+std::unique_ptr<HoughEngineBase> MakeHoughEngine(const std::string& name, const HoughConfig& base = HoughConfig());
+
+#endif
@@ -3,6 +3,9 @@
 #include <stdlib.h>
 #include <math.h>
 #include <limits>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
 #include "HoughHelper.h"
 #ifndef HoughHelper_cxx
 #define HoughHelper_cxx
@@ -21,7 +24,7 @@ pvec operator-(const pvec& a, const pvec& b) {
     return { {a[0]-b[0], a[1]-b[1]} };
 }
 pvec operator*(const pvec& a, double scale) {
-    return { {a[0]*scale, a[1]*scale} };
+    return { {fp_t(a[0]*scale), fp_t(a[1]*scale)} };
 }
 
 double length(const pvec& v) {
@@ -37,431 +40,1002 @@ double crossProduct( const pvec& a, const pvec& b ) {
 }
 
 
+void print_info_array_data(double *arr, unsigned int size){
+
+  // numhits layer r x y z charge pt d0
+  for (unsigned int i = 0; i < size; i++) {
+    std::cout << " numhits "<< arr[9*i]
+              << " layer " << arr[9*i+1]
+              << " r " << arr[9*i+2]
+              << " x " << arr[9*i+3]
+              << " y " << arr[9*i+4]
+              << " z " << arr[9*i+5]
+              << " charge " << arr[9*i+6]
+              << " pt " << arr[9*i+7]
+              << " d0 " << arr[9*i+8]
+              << std::endl;
+  }
+}
+
+
 // ================================================
-// ================================================
-void GetInfoFromFiles(string hitsFile, string partsFile, hit *hits, particle *particles, int nevents){
-  // initialize structs (maybe cleaner way?)
-  cout << " i have started initialize " << endl;
-
-  for (int i = 0; i < nevents; ++i){
-    for (int j = 0; j < 100; ++j){
-      hits[i].layer[j] = -9999; hits[i].r[j] = -9999; hits[i].x[j] = -9999; hits[i].y[j] = -9999; hits[i].z[j] = -9999;
-      particles[i].barcode[j] = -9999; particles[i].charge[j] = -9999; particles[i].pt[j] = -9999; particles[i].d0[j] = -9999;
-    }
+// ===================================================
+HoughConfig::HoughConfig() :
+  m_acceptedDistanceBetweenLayersMin(200), m_acceptedDistanceBetweenLayersMax(600),
+  m_d0_range(120), m_qOverPt_range(0.002),
+  m_imageSize_x(216), m_imageSize_y(216),
+  m_continuous(true),
+  m_threshold(8), m_threshold50(8),
+  m_latencyTarget_us(0), m_pairCost_ns(1500),
+  m_collectHits(true),
+  m_d0Kernel(D0_SIMD),
+  m_fillMode(FILL_INTERPOLATE),
+  m_coarseFactor(1), m_coarseThreshold(0),
+  m_phiSectors(1), m_phiOverlap(0.3),
+  m_z0Window(0), m_detaWindow(0),
+  m_precision(PRECISION_DOUBLE)
+{}
+
+HoughRowTable::HoughRowTable(const HoughConfig& config) :
+  qoverpt(config.m_imageSize_y), radius(config.m_imageSize_y), radius2(config.m_imageSize_y),
+  absRadius(config.m_imageSize_y), sign(config.m_imageSize_y)
+{
+  const double m_step_y = config.stepY();
+  for ( int y = 0; y < config.m_imageSize_y; y++ ) {
+    qoverpt[y] = -1.*( (y * m_step_y) + m_step_y*0.5 - config.m_qOverPt_range);
+    radius[y] = 1.0/(0.6*qoverpt[y]);
+    radius2[y] = radius[y]*radius[y];
+    absRadius[y] = std::abs(radius[y]);
+    sign[y] = std::signbit(radius[y]) ? -1.0 : 1.0;
   }
+}
 
-  cout << " i have finished initialize " << endl;
-
-  // hits file
-  int event;
-  double layer, r, x, y, z;
-  std::string line;
-  std::ifstream hitNameFile(hitsFile.c_str());
-  cout << " hits filename : " << hitsFile << endl;
-  int event1=0;
-  int idx=-1;
-  while (std::getline(hitNameFile, line)){
-    std::stringstream ss(line);
-    ss >> event >> layer >> r >> x >> y >> z;
-    if( event1 == event){ idx++; } else { idx = 0; }
-    hits[event].layer[idx] = layer; hits[event].r[idx] = r; hits[event].x[idx] = x; hits[event].y[idx] = y; hits[event].z[idx] = z;
-    event1 = event;
-  }
-
-  // particles file
-  int event_part;
-  double barcode, charge, pt, d0;
-  std::string line_part;
-  std::ifstream partNameFile(partsFile.c_str());
-  cout << " particles filename : " << partsFile << endl;
-  int event1_part=0;
-  int idx_part=-1;
-  while (std::getline(partNameFile, line_part)){
-    std::stringstream ss(line_part);
-    ss >> event_part >> barcode >> charge >> pt >> d0 ;
-    if( event1_part == event_part){ idx_part++; } else { idx_part = 0; }
-    particles[event_part].barcode[idx_part] = barcode; particles[event_part].charge[idx_part] = charge; particles[event_part].pt[idx_part] = pt; particles[event_part].d0[idx_part] = d0;
-    event1_part = event_part;
-  }
-}
-
-void GetInfoFromFile(string mergeFile, std::vector<float>& vec){
-  cout << " i am in: GetInfoFromFile " << endl;
-
-  int event;
-  double layer, r, x, y, z, charge, pt, d0, numhits;
-  std::string line;
-  std::ifstream MergeNameFile(mergeFile.c_str());
-  cout << " data filename : " << mergeFile << endl;
-  while (std::getline(MergeNameFile, line)){
-    std::stringstream ss(line);
-    ss >> event >> layer >> r >> x >> y >> z >> charge >> pt >> d0 >> numhits;
-    vec.push_back(event);
-    vec.push_back(layer);
-    vec.push_back(r);
-    vec.push_back(x);
-    vec.push_back(y);
-    vec.push_back(z);
-    vec.push_back(charge);
-    vec.push_back(pt);
-    vec.push_back(d0);
-    vec.push_back(numhits);
-  }
-}
-
-
-void GetInfoFromFile(string mergeFile, std::vector<std::vector<float>>& vec){
-  cout << " i am in: GetInfoFromFile " << endl;
-
-  int event;
-  double layer, r, x, y, z, charge, pt, d0, numhits;
-  std::string line;
-  std::ifstream MergeNameFile(mergeFile.c_str());
-  cout << " data filename : " << mergeFile << endl;
-  // int cache=-1;
-  while (std::getline(MergeNameFile, line)){
-    std::stringstream ss(line);
-    ss >> event >> layer >> r >> x >> y >> z >> charge >> pt >> d0 >> numhits;
-    // if (event>cache) vec[event].push_back(numhits);
-    vec[event].push_back(numhits);
-    vec[event].push_back(layer);
-    vec[event].push_back(r);
-    vec[event].push_back(x);
-    vec[event].push_back(y);
-    vec[event].push_back(z);
-    vec[event].push_back(charge);
-    vec[event].push_back(pt);
-    vec[event].push_back(d0);
-    // cache=event;
-  }
-}
-
-void print_info_vec_data(std::vector<float>& vec, int size){
-
-  for(int i=0; i<size; ++i){
-    std::cout << " event "<< vec[10*i]
-              << " layer " << vec[10*i+1]
-              << " r " << vec[10*i+2]
-              << " x " << vec[10*i+3]
-              << " y " << vec[10*i+4]
-              << " z " << vec[10*i+5]
-              << " charge " << vec[10*i+6]
-              << " pt " << vec[10*i+7]
-              << " d0 " << vec[10*i+8]
-              << " numhits " << vec[10*i+9]
-              << std::endl;
+struct CachedRowTable {
+  int imageSize_y;
+  float qOverPt_range;
+  std::unique_ptr<HoughRowTable> table;
+};
+
+const HoughRowTable& RowTable(const HoughConfig& config) {
+  static thread_local std::vector<CachedRowTable> tables; // most recently built last
+  for (size_t i = 0; i < tables.size(); ++i) {
+    if (tables[i].imageSize_y == config.m_imageSize_y && tables[i].qOverPt_range == config.m_qOverPt_range) return *tables[i].table;
   }
+  if (tables.size() == 4) tables.erase(tables.begin());
+  CachedRowTable cached;
+  cached.imageSize_y = config.m_imageSize_y;
+  cached.qOverPt_range = config.m_qOverPt_range;
+  cached.table.reset(new HoughRowTable(config));
+  tables.push_back(std::move(cached));
+  return *tables.back().table;
 }
 
-void print_info_vec_data(std::vector<std::vector<float>>& vec, int size){
+bool passThreshold(HoughImage &image, int x, int y, const HoughConfig& config) {
+    const int count = image(x,y);
+    const float d0 = xtod0(x, config.stepX(), config.m_d0_range);
+    if ( std::abs(d0) < 50.0 && count >= config.m_threshold50 ) return true;
+    if ( std::abs(d0) >= 50.0 && count >= config.m_threshold ) return true;
+
+    return false;
+}
 
-  for(unsigned int i=0; i<size; i++){
-    std::cout << " eventNumber: #" << i<< std::endl;
-    for(unsigned int j=0; j<vec[i].size(); j++){
-      std::cout << " " <<vec[i][j]<< " ";
+bool isLocalMaxima(HoughImage &image, int x, int y, int m_imageSize_x, int m_imageSize_y) {
+    const auto centerValue =  image(x,y);
+    for ( int xaround = std::max(x-1, 0); xaround <= std::min(m_imageSize_x-1, x+1); xaround++  ) {
+        for ( int yaround = std::max(y-1, 0); yaround <= std::min(m_imageSize_y-1, y+1); yaround++  ) {
+        if ( image(xaround,yaround) > centerValue ) { return false; }
+        }
     }
-    std::cout << std::endl;
-    std::cout << " ============================== " << std::endl;
-  }
+    return true;
 }
 
-void ConvertVecToArr(std::vector<float>& vec, double *arr){
 
-  for (unsigned int i = 0; i < vec.size(); i++) {
-        arr[i] = vec[i];
+Doublet MakeDoublet(const pvec& p1, const pvec& p2, unsigned hit1, unsigned hit2){
+  Doublet doublet;
+  doublet.hit1 = hit1;
+  doublet.hit2 = hit2;
+  doublet.half = (p2 - p1)*0.5;
+  doublet.mid = p1 + doublet.half;
+  return doublet;
+}
+
+// hits of one layer sorted by radius
+struct LayerBucket {
+  int32_t layer;
+  std::vector<double> radius;
+  std::vector<unsigned> hit; // positions in the hit list
+};
+
+// r-z compatibility of a hit pair, inner hit first (r1 < r2): the line through the two hits reaches r = 0
+// within m_z0Window of z = 0, and the eta of the hits differ by less than m_detaWindow (GetDeta, eta1 - eta2,
+// from the eta of each hit). A window <= 0 is not applied.
+static inline bool rzCompatible(double r1, double z1, double eta1, double r2, double z2, double eta2, const HoughConfig& config){
+  if (config.m_z0Window > 0 && !(std::abs(z1 - r1*GetDz(z1, z2)/(r2 - r1)) < config.m_z0Window)) return false;
+  if (config.m_detaWindow > 0 && !(std::abs(eta1 - eta2) < config.m_detaWindow)) return false;
+  return true;
+}
+
+// the doublets of hit(0)...hit(n-1), store indices of one event in increasing order, whose first hit is
+// hit(k) with k in [k0, k1)
+template <typename Hit>
+static void makeDoublets(const EventStore& store, Hit hit, size_t n, size_t k0, size_t k1, const HoughConfig& config, std::vector<Doublet>& doublets){
+
+  doublets.clear();
+  if (n < 2 || k0 >= k1) return;
+
+  const float *hx = store.x(), *hy = store.y(), *hz = store.z();
+  const int32_t *hlayer = store.layer();
+  const double drMin = config.m_acceptedDistanceBetweenLayersMin, drMax = config.m_acceptedDistanceBetweenLayersMax;
+  const bool rz = config.m_z0Window > 0 || config.m_detaWindow > 0;
+
+  static thread_local std::vector<double> radius, eta;
+  radius.resize(n);
+  for (size_t k = 0; k < n; ++k) radius[k] = GetR(hx[hit(k)], hy[hit(k)]);
+  if (rz) eta.resize(n); // only read with m_detaWindow > 0
+  if (config.m_detaWindow > 0) for (size_t k = 0; k < n; ++k) eta[k] = GetEta(hx[hit(k)], hy[hit(k)], hz[hit(k)]);
+
+  if (n < 32) { // a few hits: building the buckets costs more than testing all pairs
+    for (size_t k1st = k0; k1st < k1; ++k1st) {
+      for (size_t k2nd = k1st + 1; k2nd < n; ++k2nd) {
+        const size_t ihit1 = hit(k1st), ihit2 = hit(k2nd);
+        const double radiusDifference = radius[k2nd] - radius[k1st];
+        if (hlayer[ihit1] == hlayer[ihit2]) continue;
+        if (!(drMin < radiusDifference && radiusDifference < drMax)) continue;
+        if (rz && !rzCompatible(radius[k1st], hz[ihit1], eta[k1st], radius[k2nd], hz[ihit2], eta[k2nd], config)) continue;
+        const pvec p1 {{hx[ihit1], hy[ihit1]}};
+        const pvec p2 {{hx[ihit2], hy[ihit2]}};
+        doublets.push_back(MakeDoublet(p1, p2, ihit1, ihit2));
+      }
+    }
+    return;
+  }
+
+  static thread_local std::vector<unsigned> bucketOf;
+  static thread_local std::vector<LayerBucket> buckets;
+  bucketOf.resize(n);
+  buckets.clear();
+  for (size_t k = 0; k < n; ++k) {
+    size_t b = 0;
+    while (b < buckets.size() && buckets[b].layer != hlayer[hit(k)]) ++b;
+    if (b == buckets.size()) {
+      buckets.push_back(LayerBucket());
+      buckets.back().layer = hlayer[hit(k)];
     }
+    bucketOf[k] = b;
+  }
+
+  // k1st runs backwards and the buckets hold exactly the hits after it, so every hit found in a
+  // radius window is a partner with the pair order of the all-pairs loop
+  auto insert = [&](size_t k) {
+    LayerBucket& bucket = buckets[bucketOf[k]];
+    const size_t pos = std::upper_bound(bucket.radius.begin(), bucket.radius.end(), radius[k]) - bucket.radius.begin();
+    bucket.radius.insert(bucket.radius.begin() + pos, radius[k]);
+    bucket.hit.insert(bucket.hit.begin() + pos, k);
+  };
+  for (size_t k = k1; k < n; ++k) insert(k);
+
+  for (size_t k1st = k1; k1st-- > k0; ) {
+    const double radius_hit1 = radius[k1st];
+    // the window is widened by a rounding margin, the cut below is the exact one of the all-pairs loop
+    const double slack = 1e-9 * (std::abs(radius_hit1) + std::abs(drMax));
+    for (size_t b = 0; b < buckets.size(); ++b) {
+      if (b == bucketOf[k1st]) continue; // hits on the same layer
+      const LayerBucket& bucket = buckets[b];
+      for (size_t p = std::lower_bound(bucket.radius.begin(), bucket.radius.end(), radius_hit1 + drMin - slack) - bucket.radius.begin();
+           p < bucket.radius.size() && bucket.radius[p] <= radius_hit1 + drMax + slack; ++p) {
+        const double radiusDifference = bucket.radius[p] - radius_hit1;
+        if (!(drMin < radiusDifference && radiusDifference < drMax)) continue;
+        const size_t k2nd = bucket.hit[p], ihit1 = hit(k1st), ihit2 = hit(k2nd);
+        if (rz && !rzCompatible(radius_hit1, hz[ihit1], eta[k1st], radius[k2nd], hz[ihit2], eta[k2nd], config)) continue;
+        const pvec p1 {{hx[ihit1], hy[ihit1]}};
+        const pvec p2 {{hx[ihit2], hy[ihit2]}};
+        doublets.push_back(MakeDoublet(p1, p2, ihit1, ihit2));
+      }
+    }
+    insert(k1st);
+  }
 }
 
-//
-// void print_info_array_data(double *arr, unsigned int size){
-//
-//   for (unsigned int i = 0; i < size; i++) {
-//     std::cout << " event "<< arr[10*i]
-//               << " layer " << arr[10*i+1]
-//               << " r " << arr[10*i+2]
-//               << " x " << arr[10*i+3]
-//               << " y " << arr[10*i+4]
-//               << " z " << arr[10*i+5]
-//               << " charge " << arr[10*i+6]
-//               << " pt " << arr[10*i+7]
-//               << " d0 " << arr[10*i+8]
-//               << " numhits " << arr[10*i+9]
-//               << std::endl;
-//   }
-// }
+void MakeDoublets(const EventStore& store, size_t event, size_t firstHit, size_t lastHit, const HoughConfig& config, std::vector<Doublet>& doublets){
+  const size_t first = store.begin(event);
+  if (firstHit >= lastHit) { doublets.clear(); return; }
+  makeDoublets(store, [first](size_t k) { return first + k; }, store.nHits(event), firstHit - first, lastHit - first, config, doublets);
+}
 
-void print_info_array_data(double *arr, unsigned int size){
+void MakeDoublets(const EventStore& store, const std::vector<unsigned>& hits, const HoughConfig& config, std::vector<Doublet>& doublets){
+  makeDoublets(store, [&hits](size_t k) { return (size_t) hits[k]; }, hits.size(), 0, hits.size(), config, doublets);
+}
 
-  // numhits layer r x y z charge pt d0
-  for (unsigned int i = 0; i < size; i++) {
-    std::cout << " numhits "<< arr[9*i]
-              << " layer " << arr[9*i+1]
-              << " r " << arr[9*i+2]
-              << " x " << arr[9*i+3]
-              << " y " << arr[9*i+4]
-              << " z " << arr[9*i+5]
-              << " charge " << arr[9*i+6]
-              << " pt " << arr[9*i+7]
-              << " d0 " << arr[9*i+8]
-              << std::endl;
+static inline int d0Bin(fp_t d0, const HoughConfig& config, double m_step_x){
+  const double x = (d0 + config.m_d0_range) / m_step_x; // compared before the conversion, so NaN and huge values are rejected too
+  return ( 1 <= x && x < config.m_imageSize_x) ? int(x) : -1;
+}
+
+static void doubletBinsReference(const Doublet& doublet, const HoughConfig& config, int* xbins){
+
+  const double m_step_x = config.stepX();
+  const double m_step_y = config.stepY();
+  const pvec& halfDiff = doublet.half;
+  const fp_t halfLen = length(halfDiff);
+
+  for ( int y = 1; y < config.m_imageSize_y; y++ ) {
+    const fp_t qoverpt = -1.*( (y * m_step_y) + m_step_y*0.5 - config.m_qOverPt_range);
+    const fp_t radius = 1.0/(0.6*qoverpt);
+    const fp_t scale = std::copysign( std::sqrt( std::pow(radius/halfLen, 2) - 1), radius );
+    const pvec rprime = rotate90(halfDiff) * scale;
+    const pvec center = doublet.mid + rprime;
+    const fp_t d0 =  (std::signbit(radius) ? -1.0 : 1.0)*(length(center) - abs(radius));
+    xbins[y] = d0Bin(d0, config, m_step_x);
   }
 }
 
+DoubletTerms GetDoubletTerms(const Doublet& doublet){
 
-void SelectEvent(double *arr, unsigned int size){
-  //
-  // const double m_acceptedDistanceBetweenLayersMin = 200; // min R disstance for hits pair filtering
-  // const double m_acceptedDistanceBetweenLayersMax = 600;
-  //
-  // float m_d0_range = 120;
-  // float m_qOverPt_range = 0.002;
-  // int m_imageSize_x = 216; // i.e. number of bins in d0
-  // int m_imageSize_y = 216; // i.e. number of bins in q/pT
-  // double m_step_x = (2*m_d0_range) / m_imageSize_x; // helpers (accumulator granularity)
-  // double m_step_y = (2*m_qOverPt_range) / m_imageSize_y;
-  // bool m_continuous = true; // assure that there is continuity of the line (i.e. middle bins in d0 are filled when one q/pT step would result in a hole)
-
-  // Loop over size of array
-  for (unsigned int i = 0; i <size; i++) {
-    std::cout << " i = "<< i
-              << " event "<< arr[10*i]
-              << " layer " << arr[10*i+1]
-              << " r " << arr[10*i+2]
-              << " x " << arr[10*i+3]
-              << " y " << arr[10*i+4]
-              << " z " << arr[10*i+5]
-              << " charge " << arr[10*i+6]
-              << " pt " << arr[10*i+7]
-              << " d0 " << arr[10*i+8]
-              << " numhits " << arr[10*i+9]
-              << std::endl;
+  const fp_t hx = doublet.half[0], hy = doublet.half[1];
+  const fp_t mx = doublet.mid[0], my = doublet.mid[1];
+  DoubletTerms terms;
+  terms.h2 = hx*hx + hy*hy;
+  terms.A = mx*mx + my*my - terms.h2;
+  terms.B = 2*(my*hx - mx*hy) / std::sqrt(terms.h2);
+  return terms;
+}
+
+// scalar D0_TABLE bin of row y, -1 if the doublet does not reach the image there
+static inline int doubletBinRow(const DoubletTerms& terms, const HoughRowTable& rows, const HoughConfig& config, double m_step_x, int y){
+
+  const fp_t R2 = rows.radius2[y];
+  if ( !(R2 > terms.h2) ) return -1; // no circle of this radius through both hits
+  const fp_t t = rows.sign[y]*terms.B*std::sqrt(R2 - terms.h2);
+  const fp_t d0 = rows.sign[y]*(terms.A + t)/(std::sqrt(terms.A + R2 + t) + rows.absRadius[y]);
+  return d0Bin(d0, config, m_step_x);
+}
+
+void DoubletBinsRows(const DoubletTerms& terms, const HoughRowTable& rows, const HoughConfig& config, int firstRow, int* xbins){
+
+  const double m_step_x = config.stepX();
+  for ( int y = firstRow; y < config.m_imageSize_y; y++ ) xbins[y] = doubletBinRow(terms, rows, config, m_step_x, y);
+}
+
+bool CpuSupports(HoughD0Kernel kernel){
+  // the SIMD rows are double, bit-identical to the scalar ones only when fp_t is double
+  if ((kernel == D0_AVX2 || kernel == D0_AVX512) && !std::is_same<fp_t, double>::value) return false;
+  if (kernel == D0_AVX2) return __builtin_cpu_supports("avx2");
+  if (kernel == D0_AVX512) return __builtin_cpu_supports("avx512f");
+  return true;
+}
+
+HoughD0Kernel ResolveD0Kernel(HoughD0Kernel kernel){
+  if (kernel == D0_SIMD) {
+    static const HoughD0Kernel best = CpuSupports(D0_AVX512) ? D0_AVX512 : CpuSupports(D0_AVX2) ? D0_AVX2 : D0_TABLE;
+    return best;
   }
-  // check if events have the same eventNumber
-  // Loop over hit 1
-  // Loop over hit 2
-  // Put conditions
+  if ((kernel == D0_AVX2 || kernel == D0_AVX512) && !CpuSupports(kernel)) return D0_TABLE; // scalar fallback
+  return kernel;
+}
 
+// rows 1... of the given table with the D0_TABLE kernel of config
+static void tableBins(const DoubletTerms& terms, const HoughRowTable& rows, const HoughConfig& config, int* xbins){
+  const HoughD0Kernel kernel = ResolveD0Kernel(config.m_d0Kernel);
+  int firstRow = 1;
+  if (kernel == D0_AVX512) firstRow = DoubletBinsAVX512(terms, rows, config, xbins);
+  else if (kernel == D0_AVX2) firstRow = DoubletBinsAVX2(terms, rows, config, xbins);
+  DoubletBinsRows(terms, rows, config, firstRow, xbins);
 }
 
+void DoubletBins(const Doublet& doublet, const HoughConfig& config, int* xbins){
 
+  xbins[0] = -1; // row 0 is not filled
+  const HoughD0Kernel kernel = ResolveD0Kernel(config.m_d0Kernel);
+  if (kernel == D0_REFERENCE) {
+    doubletBinsReference(doublet, config, xbins);
+    return;
+  }
 
-// ================================================
-// ===================================================
-void printout_struct(hit *hits, particle *particles){
-  // Check outputs
-  cout << particles[1].barcode[0] << " " << particles[1].charge[0] << " " << particles[1].pt[0]  << " " << particles[1].d0[0] << endl;
-  for(int ii=0; ii<100; ii++){
-    if (hits[0].layer[ii]!=-9999){
-      cout << hits[0].layer[ii] << " " << hits[0].r[ii] << " " << hits[0].x[ii]  << " " << hits[0].y[ii] << " " << hits[0].z[ii] << endl;
-    } else {
-      continue;
+  tableBins(GetDoubletTerms(doublet), RowTable(config), config, xbins);
+}
+
+// Line of one doublet in the accumulator: visit(y, xmin, xmax) for every q/pT row it crosses,
+// with the d0 bins [xmin, xmax] that the fill increments in that row
+template <typename Visitor>
+static inline void walkDoublet(const Doublet& doublet, const HoughConfig& config, Visitor visit){
+
+  static thread_local std::vector<int> xbins;
+  xbins.resize(config.m_imageSize_y);
+  DoubletBins(doublet, config, xbins.data());
+
+  int xbefore = -1;
+
+  for ( int y = 1; y < config.m_imageSize_y; y++ ) {
+    const int x = xbins[y];
+    if ( x >= 0 ) {
+      if (xbefore == -1) xbefore = x;
+      if ( config.m_continuous ) { // fill the bins along x starting from the last one filled
+        visit(y, (xbefore < x)? xbefore: x, (xbefore < x)? x: xbefore);
+      } else {
+        visit(y, x, x);
+      }
+      xbefore = x;
     }
   }
 }
-// ================================================
-// ===================================================
-// bool passThreshold(vector2D<std::pair<int, vector<double>>> &image, int x, int y,  double m_step_x, double m_d0_range) {
-bool passThreshold(vector2D<std::pair<int, hit>> &image, int x, int y,  double m_step_x, double m_d0_range, hit *hits, particle *particles) {
-    const int count = image(x,y).first;
-    const float d0 = xtod0(x, m_step_x, m_d0_range);
-    int m_threshold = 8;
-    int m_threshold50 = 8;
-    if ( std::abs(d0) < 50.0 && count >= m_threshold50 ) return true;
-    if ( std::abs(d0) >= 50.0 && count >= m_threshold ) return true;
 
-    return false;
+// FILL_INTERPOLATE of the given doublets
+static void fillDoublets(const std::vector<Doublet>& doublets, const HoughConfig& config, HoughImage& image){
+
+  for (size_t d = 0; d < doublets.size(); ++d) {
+    walkDoublet(doublets[d], config, [&](int y, int xmin, int xmax) {
+      for ( int xinterpolated = xmin; xinterpolated <= xmax; ++xinterpolated) {
+        HoughCount& count = image(xinterpolated, y);
+        if (count != HOUGHCOUNT_MAX) count++;
+      }
+    });
+  }
 }
-bool passThreshold(vector2D<std::pair<int, hit>> &image, int x, int y,  double m_step_x, double m_d0_range) {
-    const int count = image(x,y).first;
-    const float d0 = xtod0(x, m_step_x, m_d0_range);
-    int m_threshold = 8;
-    int m_threshold50 = 8;
-    if ( std::abs(d0) < 50.0 && count >= m_threshold50 ) return true;
-    if ( std::abs(d0) >= 50.0 && count >= m_threshold ) return true;
 
-    return false;
+// Fills the accumulator with every doublet of one event
+void FillImage(const EventStore& store, size_t event, const HoughConfig& config, HoughImage& image){
+  FillImage(store, event, store.begin(event), store.end(event), config, image);
 }
 
-// bool isLocalMaxima(vector2D<std::pair<int, vector<double>>> &image, int x, int y, int m_imageSize_x, int m_imageSize_y) {
-bool isLocalMaxima(vector2D<std::pair<int, hit>> &image, int x, int y, int m_imageSize_x, int m_imageSize_y, hit *hits, particle *particles) {
-    const auto centerValue =  image(x,y).first;
-    for ( int xaround = std::min(x-1, 0); xaround <= std::max(m_imageSize_x-1, x+1); xaround++  ) {
-        for ( int yaround = std::min(y-1, 0); yaround <= std::max(m_imageSize_y-1, y+1); yaround++  ) {
-        if ( image(xaround,yaround).first > centerValue ) { return false; }
-        }
-    }
-    return true;
+// one d0 column of the prefix sum; the 16/32-bit mix is only vectorized by -O2 with the dynamic cost model
+__attribute__((optimize("tree-vectorize", "vect-cost-model=dynamic")))
+static void addDeltaColumn(int32_t* __restrict running, int32_t* __restrict delta, HoughCount* __restrict bins, int n){
+  for (int y = 0; y < n; ++y) {
+    running[y] += delta[y];
+    delta[y] = 0;
+    const uint32_t sum = uint32_t(bins[y]) + uint32_t(running[y]);
+    bins[y] = sum < HOUGHCOUNT_MAX ? sum : HOUGHCOUNT_MAX;
+  }
 }
-bool isLocalMaxima(vector2D<std::pair<int, hit>> &image, int x, int y, int m_imageSize_x, int m_imageSize_y) {
-    const auto centerValue =  image(x,y).first;
-    for ( int xaround = std::max(x-1, 0); xaround <= std::min(m_imageSize_x-1, x+1); xaround++  ) {
-   for ( int yaround = std::max(y-1, 0); yaround <= std::min(m_imageSize_y-1, y+1); yaround++  ) {
-    // for ( int xaround = std::min(x-1, 0); xaround <= std::max(m_imageSize_x-1, x+1); xaround++  ) {
-        // for ( int yaround = std::min(y-1, 0); yaround <= std::max(m_imageSize_y-1, y+1); yaround++  ) {
-        if ( image(xaround,yaround).first > centerValue ) { return false; }
+
+// Segment ends of every doublet in a difference array laid out like the image, with one spare
+// d0 column for segments that end in the last bin; the prefix sum along d0 adds them to image
+// and leaves the array zeroed for the next fill. Counts are summed before the saturation, so the
+// result is the one of the increments.
+static void fillDifference(const EventStore& store, size_t event, size_t firstHit, size_t lastHit, const HoughConfig& config, HoughImage& image){
+
+  static thread_local vector2D<int32_t> deltas;
+  if (deltas.size(0) != (size_t) config.m_imageSize_x + 1 || deltas.size(1) != (size_t) config.m_imageSize_y) {
+    deltas = vector2D<int32_t>(config.m_imageSize_x + 1, config.m_imageSize_y);
+  }
+
+  static thread_local std::vector<Doublet> doublets;
+  MakeDoublets(store, event, firstHit, lastHit, config, doublets);
+  int xlo = config.m_imageSize_x, xhi = -1, ylo = config.m_imageSize_y, yhi = -1; // bounding box of the segments
+
+  for (size_t d = 0; d < doublets.size(); ++d) {
+    walkDoublet(doublets[d], config, [&](int y, int xmin, int xmax) {
+      deltas(xmin, y)++;
+      deltas(xmax + 1, y)--;
+      xlo = std::min(xlo, xmin); xhi = std::max(xhi, xmax);
+      ylo = std::min(ylo, y); yhi = std::max(yhi, y);
+    });
+  }
+  if (xhi < 0) return;
+
+  // the running sums are back to 0 after column xhi+1, outside the box nothing changes
+  static thread_local std::vector<int32_t> running;
+  running.assign(config.m_imageSize_y, 0);
+  for (int x = xlo; x <= xhi; ++x) addDeltaColumn(running.data() + ylo, deltas[x] + ylo, image[x] + ylo, yhi - ylo + 1);
+  std::fill(deltas[xhi + 1] + ylo, deltas[xhi + 1] + yhi + 1, 0);
+}
+
+void FillImage(const EventStore& store, size_t event, size_t firstHit, size_t lastHit, const HoughConfig& config, HoughImage& image){
+
+  if (config.m_fillMode == FILL_DIFFERENCE) {
+    fillDifference(store, event, firstHit, lastHit, config, image);
+    return;
+  }
+
+  static thread_local std::vector<Doublet> doublets;
+  MakeDoublets(store, event, firstHit, lastHit, config, doublets);
+  fillDoublets(doublets, config, image);
+}
+
+// CollectRoadHits over the given doublets
+static void collectRoadHits(const std::vector<Doublet>& doublets, const HoughConfig& config, std::vector<Road>& roads, size_t firstRoad){
+
+  // roads of each q/pT row
+  std::vector<std::vector<size_t>> rowRoads(config.m_imageSize_y);
+  for (size_t i = firstRoad; i < roads.size(); ++i) {
+    rowRoads[roads[i].y].push_back(i);
+    roads[i].hits.clear();
+  }
+
+  for (size_t d = 0; d < doublets.size(); ++d) {
+    walkDoublet(doublets[d], config, [&](int y, int xmin, int xmax) {
+      for (size_t k = 0; k < rowRoads[y].size(); ++k) {
+        Road& road = roads[rowRoads[y][k]];
+        if (xmin <= road.x && road.x <= xmax) {
+          road.hits.push_back(doublets[d].hit1);
+          road.hits.push_back(doublets[d].hit2);
         }
+      }
+    });
+  }
+
+  for (size_t i = firstRoad; i < roads.size(); ++i) {
+    std::sort(roads[i].hits.begin(), roads[i].hits.end());
+    roads[i].hits.erase(std::unique(roads[i].hits.begin(), roads[i].hits.end()), roads[i].hits.end());
+  }
+}
+
+void CollectRoadHits(const EventStore& store, size_t event, const HoughConfig& config, std::vector<Road>& roads, size_t firstRoad){
+
+  if (firstRoad >= roads.size()) return;
+  static thread_local std::vector<Doublet> doublets;
+  MakeDoublets(store, event, store.begin(event), store.end(event), config, doublets);
+  collectRoadHits(doublets, config, roads, firstRoad);
+}
+
+unsigned IntraEventSlices(size_t nhits, const HoughConfig& config, unsigned maxSlices){
+
+  if (config.m_latencyTarget_us <= 0 || maxSlices <= 1 || nhits < 2) return 1;
+  const double serial_us = 0.5 * nhits * (nhits - 1) * config.m_pairCost_ns * 1e-3;
+  const double slices = std::ceil(serial_us / config.m_latencyTarget_us);
+  return slices >= maxSlices ? maxSlices : std::max(1.0, slices);
+}
+
+void FillImageParallel(const EventStore& store, size_t event, const HoughConfig& config, ThreadPool& pool, unsigned nslices,
+                       std::vector<HoughImage>& slices, HoughImage& image){
+
+  if (nslices <= 1) {
+    FillImage(store, event, config, image);
+    return;
+  }
+
+  // hit ihit1 pairs with every later hit, so cut the outer loop where the running pair count
+  // reaches k/nslices of the total
+  const size_t first = store.begin(event), n = store.nHits(event);
+  const double totalPairs = 0.5 * n * (n - 1);
+  std::vector<size_t> bounds(1, first);
+  double pairs = 0;
+  for (size_t i = 0; i < n && bounds.size() < nslices; ++i) {
+    pairs += n - 1 - i;
+    if (pairs >= totalPairs * bounds.size() / nslices) bounds.push_back(first + i + 1);
+  }
+  while (bounds.size() <= nslices) bounds.push_back(store.end(event));
+
+  if (slices.size() < nslices) slices.resize(nslices);
+  pool.parallelFor(nslices, [&](size_t k, unsigned) {
+    if (slices[k].size(0) != (size_t) config.m_imageSize_x || slices[k].size(1) != (size_t) config.m_imageSize_y) {
+      slices[k] = HoughImage(config.m_imageSize_x, config.m_imageSize_y);
+    } else {
+      slices[k].fill();
     }
-    return true;
+    FillImage(store, event, bounds[k], bounds[k+1], config, slices[k]);
+  });
+
+  // reduction, partitioned over d0 rows; integer sums so the counts are exactly the serial ones
+  pool.parallelFor(config.m_imageSize_x, [&](size_t x, unsigned) {
+    HoughCount* bins = image[x];
+    for (int y = 0; y < config.m_imageSize_y; ++y) {
+      unsigned sum = bins[y];
+      for (unsigned k = 0; k < nslices; ++k) sum += slices[k][x][y];
+      bins[y] = sum < HOUGHCOUNT_MAX ? sum : HOUGHCOUNT_MAX;
+    }
+  });
 }
 
+// Column helpers of FindPeaks. Unsigned 16-bit max needs SSE4.1, so they are cloned for AVX2
+// and picked at load time; -O2 vectorizes them only with the dynamic cost model.
+#define PEAK_KERNEL __attribute__((target_clones("avx2", "default"), optimize("tree-vectorize", "vect-cost-model=dynamic")))
+
+static inline HoughCount max2(HoughCount a, HoughCount b) { return a < b ? b : a; }
 
-void SelectEvents(hit *hits, particle *particles, int nevents){
+// max over y-1, y, y+1 of one d0 column, clipped at the image edge
+PEAK_KERNEL
+static void columnMax3(const HoughCount* __restrict column, HoughCount* __restrict out, int n){
+  if (n == 1) { out[0] = column[0]; return; }
+  out[0] = max2(column[0], column[1]);
+  for (int y = 1; y < n-1; ++y) out[y] = max2(max2(column[y-1], column[y]), column[y+1]);
+  out[n-1] = max2(column[n-2], column[n-1]);
+}
 
-  const double m_acceptedDistanceBetweenLayersMin = 200; // min R disstance for hits pair filtering
-  const double m_acceptedDistanceBetweenLayersMax = 600;
+// 1 where the bin passes the threshold and is the maximum of its neighbourhood
+PEAK_KERNEL
+static void peakFlags(const HoughCount* __restrict left, const HoughCount* __restrict centre, const HoughCount* __restrict right,
+                      const HoughCount* __restrict column, HoughCount threshold, uint8_t* __restrict flags, int n){
+  for (int y = 0; y < n; ++y) {
+    const HoughCount around = max2(max2(left[y], centre[y]), right[y]);
+    flags[y] = (column[y] >= threshold) & (column[y] >= around);
+  }
+}
 
-  float m_d0_range = 120;
-  float m_qOverPt_range = 0.002;
-  int m_imageSize_x = 216; // i.e. number of bins in d0
-  int m_imageSize_y = 216; // i.e. number of bins in q/pT
-  double m_step_x = (2*m_d0_range) / m_imageSize_x; // helpers (accumulator granularity)
-  double m_step_y = (2*m_qOverPt_range) / m_imageSize_y;
-  bool m_continuous = true; // assure that there is continuity of the line (i.e. middle bins in d0 are filled when one q/pT step would result in a hole)
+void FindPeaks(const HoughImage& image, const HoughConfig& config, std::vector<HoughPeak>& peaks){
 
-  for(int event=0; event<nevents; event++){
-    // if (event>2) continue;
-    vector2D<std::pair<int, hit>> image(m_imageSize_x, m_imageSize_y);
+  const int X = config.m_imageSize_x, Y = config.m_imageSize_y;
 
-    for(int ihit1=0; ihit1<100; ihit1++){
-      for(int ihit2=ihit1+1; ihit2<100; ihit2++){
+  // column maxima of x-1, x and x+1 in a ring
+  static thread_local std::vector<HoughCount> ring;
+  static thread_local std::vector<uint8_t> flags;
+  static thread_local std::vector<HoughPeak> found; // in column order
+  static thread_local std::vector<size_t> rowStart;
+  ring.resize(3*Y);
+  flags.resize(Y + 8); // whole 8-byte words are scanned
+  std::fill(flags.begin() + Y, flags.end(), 0);
+  found.clear();
+  HoughCount* colMax[3] = {&ring[0], &ring[Y], &ring[2*Y]};
 
-        double radius_hit1 = GetR(hits[event].x[ihit1], hits[event].y[ihit1]);
-        double radius_hit2 = GetR(hits[event].x[ihit2], hits[event].y[ihit2]);
-        double radiusDifference =  radius_hit2 - radius_hit1;
+  columnMax3(image[0], colMax[1], Y);
+  for (int x = 0; x < X; ++x) {
+    // colMax[0] = x-1 (or x at the left edge), colMax[1] = x, colMax[2] = x+1 (or x at the right edge)
+    if (x + 1 < X) columnMax3(image[x+1], colMax[2], Y);
 
-        if ( hits[event].layer[ihit1] == hits[event].layer[ihit2]){
-          continue;
+    const float d0 = xtod0(x, config.stepX(), config.m_d0_range); // threshold as in passThreshold
+    const int threshold = std::abs(d0) < 50.0 ? config.m_threshold50 : config.m_threshold;
+    if (threshold <= HOUGHCOUNT_MAX) {
+      const HoughCount* column = image[x];
+      peakFlags(x > 0 ? colMax[0] : colMax[1], colMax[1], x + 1 < X ? colMax[2] : colMax[1], column,
+                std::max(threshold, 0), flags.data(), Y);
+      for (int y = 0; y < Y; y += 8) {
+        uint64_t word;
+        memcpy(&word, &flags[y], 8);
+        if (word == 0) continue; // most of the image
+        for (int k = y; k < y + 8 && k < Y; ++k) {
+          if (!flags[k]) continue;
+          HoughPeak peak;
+          peak.x = x;
+          peak.y = k;
+          peak.count = column[k];
+          found.push_back(peak);
         }
+      }
+    }
+    std::swap(colMax[0], colMax[1]);
+    std::swap(colMax[1], colMax[2]);
+  }
 
-        if (  not (m_acceptedDistanceBetweenLayersMin < radiusDifference && radiusDifference < m_acceptedDistanceBetweenLayersMax) ){
-          continue;
+  // counting sort by q/pT row, stable, so d0 bins stay increasing within a row
+  rowStart.assign(Y + 1, 0);
+  for (size_t i = 0; i < found.size(); ++i) rowStart[found[i].y + 1]++;
+  for (int y = 0; y < Y; ++y) rowStart[y+1] += rowStart[y];
+  const size_t firstPeak = peaks.size();
+  peaks.resize(firstPeak + found.size());
+  for (size_t i = 0; i < found.size(); ++i) peaks[firstPeak + rowStart[found[i].y]++] = found[i];
+}
+
+void FindRoads(HoughImage& image, size_t event, const HoughConfig& config, std::vector<Road>& roads){
+
+  static thread_local std::vector<HoughPeak> peaks;
+  peaks.clear();
+  FindPeaks(image, config, peaks);
+  for (size_t i = 0; i < peaks.size(); ++i) {
+    Road road;
+    road.event = event;
+    road.x = peaks[i].x;
+    road.y = peaks[i].y;
+    road.count = peaks[i].count;
+    roads.push_back(road);
+  }
+}
+
+// HoughEvent with m_coarseFactor > 1, image is already cleared. The coarse row cy covers the fine rows
+// [cy*k, cy*k + k), whose continuous segments run from the bin of row cy*k - 1 to the one of row cy*k + k - 1,
+// so the first pass only evaluates the last fine row of every coarse row (the "edges", as a row table of
+// their own so that the SIMD kernels apply) and takes the span between two edges as the coarse segment. Within a coarse row the d0 of a doublet is monotonic in q/pT, so
+// a coarse cell counts every doublet that crosses one of its bins at least once and never falls below the
+// fine counts. Where the line enters or leaves the image inside a coarse row all its fine rows are evaluated;
+// a line that is outside at both edges of a coarse row is taken to be outside in between.
+static void houghEventCoarseToFine(const EventStore& store, size_t event, const HoughConfig& config, HoughImage& image, std::vector<Road>& roads){
+
+  const int k = config.m_coarseFactor;
+  if (config.m_imageSize_x % k != 0 || config.m_imageSize_y % k != 0) {
+    throw std::invalid_argument("HoughEvent: m_coarseFactor " + std::to_string(k) + " does not divide the image size");
+  }
+  const int X = config.m_imageSize_x / k, Y = config.m_imageSize_y / k;
+  const HoughRowTable& rows = RowTable(config);
+  const double m_step_x = config.stepX();
+
+  // edge row cy*k + k - 1 of the fine table as row cy + 1 (row 0 is never evaluated)
+  HoughConfig edgeConfig = config;
+  edgeConfig.m_imageSize_y = Y + 1;
+  HoughRowTable edgeRows(edgeConfig);
+  for (int cy = 0; cy < Y; ++cy) {
+    const int y = cy*k + k - 1;
+    edgeRows.qoverpt[cy+1] = rows.qoverpt[y];
+    edgeRows.radius[cy+1] = rows.radius[y];
+    edgeRows.radius2[cy+1] = rows.radius2[y];
+    edgeRows.absRadius[cy+1] = rows.absRadius[y];
+    edgeRows.sign[cy+1] = rows.sign[y];
+  }
+
+  static thread_local std::vector<Doublet> doublets;
+  static thread_local std::vector<int> edgeBins, segments; // segments: d0 cells [lo, hi] per doublet and coarse row, -1 if none
+  MakeDoublets(store, event, store.begin(event), store.end(event), config, doublets);
+  const size_t nd = doublets.size();
+  edgeBins.resize(Y + 1);
+  segments.resize(2 * nd * Y);
+
+  // first pass: each doublet counts once in every coarse cell its line crosses
+  static thread_local HoughImage coarseImage;
+  if (coarseImage.size(0) != (size_t) X || coarseImage.size(1) != (size_t) Y) coarseImage = HoughImage(X, Y);
+  else coarseImage.fill();
+  for (size_t d = 0; d < nd; ++d) {
+    const DoubletTerms terms = GetDoubletTerms(doublets[d]);
+    tableBins(terms, edgeRows, edgeConfig, edgeBins.data());
+    const int* edge = &edgeBins[1];
+    int* segment = &segments[2 * d * Y];
+    for (int cy = 0; cy < Y; ++cy) {
+      const int before = cy > 0 ? edge[cy-1] : -1;
+      int lo = std::min(before, edge[cy]), hi = std::max(before, edge[cy]);
+      if (cy == 0 || (before < 0) != (edge[cy] < 0)) { // row 0, or the line enters or leaves the image in this coarse row
+        lo = hi;
+        for (int y = std::max(cy*k, 1); y < cy*k + k - 1; ++y) {
+          const int x = doubletBinRow(terms, rows, config, m_step_x, y);
+          if (x < 0) continue;
+          lo = lo < 0 ? x : std::min(lo, x);
+          hi = std::max(hi, x);
         }
+      }
+      segment[2*cy] = lo < 0 ? -1 : lo / k;
+      segment[2*cy+1] = hi < 0 ? -1 : hi / k;
+      for (int cx = segment[2*cy]; lo >= 0 && cx <= segment[2*cy+1]; ++cx) {
+        HoughCount& count = coarseImage(cx, cy);
+        if (count != HOUGHCOUNT_MAX) count++;
+      }
+    }
+  }
 
-        const pvec p1 {{hits[event].x[ihit1], hits[event].y[ihit1]}};
-        const pvec p2 {{hits[event].x[ihit2], hits[event].y[ihit2]}};
-        const pvec halfDiff = (p2 - p1)*0.5;
-        const fp_t halfLen = length(halfDiff);
-
-        int xbefore = -1;
-
-        for ( int y = 1; y < m_imageSize_y+1; y++ ) {
-          const fp_t qoverpt = -1.*( (y * m_step_y) + m_step_y*0.5 - m_qOverPt_range);
-          const fp_t radius = 1.0/(0.6*qoverpt);
-          const fp_t scale = std::copysign( std::sqrt( std::pow(radius/halfLen, 2) - 1), radius );
-          const pvec rprime = rotate90(halfDiff) * scale;
-          const pvec center = p1 + halfDiff + rprime;
-          const fp_t d0 =  (std::signbit(radius) ? -1.0 : 1.0)*(length(center) - abs(radius));
-          int x = (d0 + m_d0_range) / m_step_x;
-          // cout << x << endl;
-          if ( 1 <= x && x < m_imageSize_x) {
-            if (xbefore == -1) xbefore = x;
-            if ( m_continuous ) { // fill the bins along x starting from the last one filled
-              const int xmin =  (xbefore < x)? xbefore: x;
-              const int xmax =  (xbefore < x)? x: xbefore;
-              for ( int xinterpolated = xmin; xinterpolated <= xmax; ++xinterpolated) {
-                image(xinterpolated, y).first++;
-                image(xinterpolated, y).second =  hits[event] ;
-                // image(xinterpolated, y).second =  hits[event].x[ihit2] ;
-              }
-            } else {
-                image(x, y).first++;
-                image(x, y).second =  hits[event] ;
-                // image(x, y).second.insert( hits[event].x );
-                // image(x, y).second.insert( hits[event].x );
-            }
-            xbefore = x;
-            }
-          }
+  // cells to refine, and the ring around them that the 3x3 maxima of their bins look at
+  const int threshold = config.m_coarseThreshold > 0 ? config.m_coarseThreshold : std::min(config.m_threshold, config.m_threshold50);
+  static thread_local vector2D<uint8_t> hot, near;
+  if (hot.size(0) != (size_t) X || hot.size(1) != (size_t) Y) {
+    hot = vector2D<uint8_t>(X, Y);
+    near = vector2D<uint8_t>(X, Y);
+  } else {
+    hot.fill();
+    near.fill();
+  }
+  bool any = false;
+  for (int x = 0; x < X; ++x) {
+    for (int y = 0; y < Y; ++y) {
+      if (coarseImage(x, y) < threshold) continue;
+      any = true;
+      hot(x, y) = 1;
+      for (int xn = std::max(x-1, 0); xn <= std::min(X-1, x+1); ++xn) {
+        for (int yn = std::max(y-1, 0); yn <= std::min(Y-1, y+1); ++yn) near(xn, yn) = 1;
       }
     }
-    for (int y = 0; y < m_imageSize_y; y++) {
-      for (int x = 0; x < m_imageSize_x; x++) {
-        if (passThreshold(image, x, y, m_step_x, m_d0_range, hits, particles) && isLocalMaxima( image, x, y, m_imageSize_x, m_imageSize_y, hits, particles) ) {
-          // roads.push_back(createRoad(image(x, y).second, x, y));
-          if (event==1 || event==2 || event == 3) {
-            // cout << image(x, y).second.x << " " << image(x, y).second.r ;
-            cout << " d0: " << xtod0(x, m_step_x, m_d0_range) << " truthd0: " << particles[event].d0[0]  << " resolution d0 :" << (particles[event].d0[0] - xtod0(x, m_step_x, m_d0_range) )
-                 << " q/pt " << ytoqoverpt(y, m_step_y, m_qOverPt_range) << " truth q/pT: " << particles[event].charge[0] / particles[event].pt[0]<< " resolution q/pT :" << (particles[event].charge[0] / particles[event].pt[0] - ytoqoverpt(y, m_step_y, m_qOverPt_range))<<  endl;
-          }
+  }
+  if (!any) return;
+
+  // second pass: the fine rows of the coarse rows in which a doublet crosses one of those cells, filled
+  // as walkDoublet does, starting from the bin of the row before. All rows of such a doublet are binned
+  // at once, which with the SIMD kernels costs less than picking them one by one.
+  static thread_local std::vector<int> xbins;
+  xbins.resize(config.m_imageSize_y);
+  for (size_t d = 0; d < nd; ++d) {
+    const int* segment = &segments[2 * d * Y];
+    bool binned = false;
+    for (int cy = 0; cy < Y; ++cy) {
+      bool crosses = false;
+      for (int cx = segment[2*cy]; cx >= 0 && cx <= segment[2*cy+1] && !crosses; ++cx) crosses = near(cx, cy);
+      if (!crosses) continue;
+      if (!binned) tableBins(GetDoubletTerms(doublets[d]), rows, config, xbins.data());
+      binned = true;
+      int xbefore = cy > 0 ? xbins[cy*k - 1] : -1;
+      for (int y = std::max(cy*k, 1); y < cy*k + k; ++y) {
+        const int x = xbins[y];
+        if (x < 0) continue;
+        if (xbefore == -1) xbefore = x;
+        const int xmin = config.m_continuous ? std::min(xbefore, x) : x, xmax = config.m_continuous ? std::max(xbefore, x) : x;
+        for (int xi = xmin; xi <= xmax; ++xi) {
+          HoughCount& count = image(xi, y);
+          if (count != HOUGHCOUNT_MAX) count++;
         }
+        xbefore = x;
       }
     }
   }
+
+  // outside the cells the counts are partial, the peaks there are not roads
+  static thread_local std::vector<Road> found;
+  found.clear();
+  FindRoads(image, event, config, found);
+  const size_t firstRoad = roads.size();
+  for (size_t i = 0; i < found.size(); ++i) {
+    if (hot(found[i].x / k, found[i].y / k)) roads.push_back(found[i]);
+  }
+  if (config.m_collectHits) CollectRoadHits(store, event, config, roads, firstRoad);
 }
 
+// phi of a hit from the centre of wedge s, as GetDphi, in [-pi, pi]
+static inline double sectorDphi(double phi, int s, double width){
+  return std::remainder(phi - (-M_PI + (s + 0.5)*width), 2*M_PI);
+}
 
-void HoughTransform(double *arr){
-
-
-  std::cout << " Hello I am here " << std::endl;
-  float m_d0_range = 120;
-  float m_qOverPt_range = 0.002;
-  int m_imageSize_x = 216; // i.e. number of bins in d0
-  int m_imageSize_y = 216; // i.e. number of bins in q/pT
-  double m_step_x = (2*m_d0_range) / m_imageSize_x; // helpers (accumulator granularity)
-  double m_step_y = (2*m_qOverPt_range) / m_imageSize_y;
-  bool m_continuous = true; // assure that there is continuity of the line (i.e. middle bins in d0 are filled when one q/pT step would result in a hole)
-
-  // if (event>2) continue;
-  vector2D<std::pair<int, hit>> image(m_imageSize_x, m_imageSize_y);
-
-  int sizeout = sizeof(arr);
-  // sizeout /= 9;
-  std::cout << " sizeout: " << sizeout<<  std::endl;
-
-  for(int ihit1=0; ihit1<sizeout; ihit1++){
-    for(int ihit2=1; ihit2<sizeout; ihit2++){
-
-      const pvec p1 {{arr[9*ihit1+3], arr[9*ihit1+4]}}; // x and y for hit1
-      const pvec p2 {{arr[9*ihit2+3], arr[9*ihit2+4]}};// x and y for hit1
-      const pvec halfDiff = (p2 - p1)*0.5;
-      const fp_t halfLen = length(halfDiff);
-
-      int xbefore = -1;
-
-      for ( int y = 1; y < m_imageSize_y+1; y++ ) {
-        const fp_t qoverpt = -1.*( (y * m_step_y) + m_step_y*0.5 - m_qOverPt_range);
-        const fp_t radius = 1.0/(0.6*qoverpt);
-        const fp_t scale = std::copysign( std::sqrt( std::pow(radius/halfLen, 2) - 1), radius );
-        const pvec rprime = rotate90(halfDiff) * scale;
-        const pvec center = p1 + halfDiff + rprime;
-        const fp_t d0 =  (std::signbit(radius) ? -1.0 : 1.0)*(length(center) - abs(radius));
-        int x = (d0 + m_d0_range) / m_step_x;
-        cout << " x: " << x << endl;
-        if ( 1 <= x && x < m_imageSize_x) {
-          if (xbefore == -1) xbefore = x;
-          if ( m_continuous ) { // fill the bins along x starting from the last one filled
-            const int xmin =  (xbefore < x)? xbefore: x;
-            const int xmax =  (xbefore < x)? x: xbefore;
-            for ( int xinterpolated = xmin; xinterpolated <= xmax; ++xinterpolated) {
-              image(xinterpolated, y).first++;
-              // image(xinterpolated, y).second =  hits[event] ;
-              // image(xinterpolated, y).second =  hits[event].x[ihit2] ;
-            }
-          } else {
-              image(x, y).first++;
-              // image(x, y).second =  hits[event] ;
-              // image(x, y).second.insert( hits[event].x );
-              // image(x, y).second.insert( hits[event].x );
-          }
-          xbefore = x;
-        }
+// PhiSectorHits, also giving the phi of every hit of the event (index hit - store.begin(event)) so that
+// sectorRoads does not evaluate GetPhi again
+static void phiSectorHits(const EventStore& store, size_t event, const HoughConfig& config, std::vector<std::vector<unsigned>>& sectors, std::vector<double>& phi){
+
+  const int nsectors = std::max(config.m_phiSectors, 1);
+  const double width = 2*M_PI / nsectors, reach = 0.5*width + config.m_phiOverlap;
+  sectors.resize(nsectors);
+  for (int s = 0; s < nsectors; ++s) sectors[s].clear();
+  const float *hx = store.x(), *hy = store.y();
+  const size_t first = store.begin(event);
+  phi.resize(store.nHits(event));
+  for (size_t hit = first; hit < store.end(event); ++hit) {
+    phi[hit - first] = GetPhi(hx[hit], hy[hit]);
+    for (int s = 0; s < nsectors; ++s) {
+      if (nsectors == 1 || std::abs(sectorDphi(phi[hit - first], s, width)) <= reach) sectors[s].push_back(hit);
+    }
+  }
+}
+
+void PhiSectorHits(const EventStore& store, size_t event, const HoughConfig& config, std::vector<std::vector<unsigned>>& sectors){
+  static thread_local std::vector<double> phi;
+  phiSectorHits(store, event, config, sectors, phi);
+}
+
+// roads of the hits of wedge s, appended to roads. A doublet with both hits in the same overlap margin is
+// also a doublet of the neighbour wedge on that side, which sees the rest of its track; a road made of such
+// doublets only is a piece of a track that the neighbour finds whole, and is dropped here. phi is the one
+// of phiSectorHits.
+static void sectorRoads(const EventStore& store, size_t event, int s, const std::vector<unsigned>& hits, const std::vector<double>& phi, const HoughConfig& config, HoughImage& image, std::vector<Road>& roads){
+
+  static thread_local std::vector<Doublet> doublets, inner, margin;
+  MakeDoublets(store, hits, config, doublets);
+  // no bin counts more doublets than the wedge has, so most wedges of a sparse event are done here
+  if (doublets.size() < (size_t) std::max(std::min(config.m_threshold, config.m_threshold50), 1)) return;
+
+  if (image.size(0) != (size_t) config.m_imageSize_x || image.size(1) != (size_t) config.m_imageSize_y) {
+    image = HoughImage(config.m_imageSize_x, config.m_imageSize_y);
+  } else {
+    image.fill();
+  }
+
+  // side of the margin each hit is in: -1, +1, or 0 inside the wedge proper, index hit - store.begin(event)
+  const double width = 2*M_PI / std::max(config.m_phiSectors, 1);
+  const size_t first = store.begin(event);
+  static thread_local std::vector<signed char> side;
+  side.resize(phi.size());
+  for (size_t h = 0; h < hits.size(); ++h) {
+    const double dphi = sectorDphi(phi[hits[h] - first], s, width);
+    side[hits[h] - first] = dphi > 0.5*width ? 1 : (dphi < -0.5*width ? -1 : 0);
+  }
+  inner.clear();
+  margin.clear();
+  for (size_t d = 0; d < doublets.size(); ++d) {
+    const int side1 = side[doublets[d].hit1 - first];
+    if (side1 != 0 && side[doublets[d].hit2 - first] == side1) margin.push_back(doublets[d]);
+    else inner.push_back(doublets[d]);
+  }
+
+  // the margin doublets alone first, kept to tell the roads that have no other doublet
+  static thread_local HoughImage marginImage;
+  fillDoublets(margin, config, image);
+  if (!margin.empty()) marginImage = image;
+  fillDoublets(inner, config, image);
+  const size_t firstRoad = roads.size();
+  FindRoads(image, event, config, roads);
+  if (!margin.empty()) {
+    size_t kept = firstRoad;
+    for (size_t i = firstRoad; i < roads.size(); ++i) {
+      if (marginImage(roads[i].x, roads[i].y) == image(roads[i].x, roads[i].y)) continue;
+      if (kept != i) roads[kept] = std::move(roads[i]);
+      kept++;
+    }
+    roads.resize(kept);
+  }
+  if (config.m_collectHits) collectRoadHits(doublets, config, roads, firstRoad);
+}
+
+// roads[firstRoad...] of the wedges in wedge order, wedge s ending at wedgeEnds[s]: one road per bin, the
+// first one with the highest count, and only the local maxima of the merged roads in FindPeaks order. A track
+// in an overlap is often found by two wedges, the one with part of its hits one bin away with a lower count:
+// a road goes when a road of a neighbour bin has a higher count, or the same count in another wedge and
+// comes first in FindPeaks order. Equal neighbours of one wedge stay, as in FindPeaks.
+static void mergeSectorRoads(std::vector<Road>& roads, size_t firstRoad, const std::vector<size_t>& wedgeEnds){
+
+  struct Candidate { size_t road; size_t wedge; };
+  std::vector<Candidate> candidates;
+  for (size_t i = firstRoad, s = 0; i < roads.size(); ++i) {
+    while (wedgeEnds[s] <= i) ++s;
+    candidates.push_back(Candidate{i, s});
+  }
+  std::stable_sort(candidates.begin(), candidates.end(), [&roads](const Candidate& a, const Candidate& b) {
+    const Road &ra = roads[a.road], &rb = roads[b.road];
+    if (ra.y != rb.y) return ra.y < rb.y;
+    if (ra.x != rb.x) return ra.x < rb.x;
+    return ra.count > rb.count;
+  });
+  size_t nbins = 0;
+  for (size_t c = 0; c < candidates.size(); ++c) {
+    const Road& road = roads[candidates[c].road];
+    if (nbins > 0 && roads[candidates[nbins-1].road].x == road.x && roads[candidates[nbins-1].road].y == road.y) continue;
+    candidates[nbins++] = candidates[c];
+  }
+  candidates.resize(nbins);
+
+  // neighbours looked up by bin, (y, x) packed in one key
+  static thread_local std::unordered_map<uint64_t, size_t> byBin;
+  byBin.clear();
+  auto key = [](int x, int y) { return (uint64_t(uint32_t(y)) << 32) | uint32_t(x); };
+  for (size_t c = 0; c < candidates.size(); ++c) byBin[key(roads[candidates[c].road].x, roads[candidates[c].road].y)] = c;
+
+  std::vector<Road> merged;
+  merged.reserve(candidates.size());
+  for (size_t c = 0; c < candidates.size(); ++c) {
+    const Road& road = roads[candidates[c].road];
+    bool peak = true;
+    for (int dy = -1; dy <= 1 && peak; ++dy) {
+      for (int dx = -1; dx <= 1 && peak; ++dx) {
+        if (dx == 0 && dy == 0) continue;
+        std::unordered_map<uint64_t, size_t>::const_iterator it = byBin.find(key(road.x + dx, road.y + dy));
+        if (it == byBin.end()) continue;
+        const Road& other = roads[candidates[it->second].road];
+        peak = other.count < road.count || (other.count == road.count && (candidates[it->second].wedge == candidates[c].wedge || it->second > c));
       }
     }
+    if (peak) merged.push_back(std::move(roads[candidates[c].road]));
+  }
+  roads.resize(firstRoad);
+  roads.insert(roads.end(), std::make_move_iterator(merged.begin()), std::make_move_iterator(merged.end()));
+}
+
+static void houghEventSectors(const EventStore& store, size_t event, const HoughConfig& config, HoughImage& image, std::vector<Road>& roads){
+
+  static thread_local std::vector<std::vector<unsigned>> sectors;
+  static thread_local std::vector<double> phi;
+  phiSectorHits(store, event, config, sectors, phi);
+  const size_t firstRoad = roads.size();
+  static thread_local std::vector<size_t> wedgeEnds;
+  wedgeEnds.clear();
+  for (size_t s = 0; s < sectors.size(); ++s) {
+    sectorRoads(store, event, s, sectors[s], phi, config, image, roads);
+    wedgeEnds.push_back(roads.size());
+  }
+  mergeSectorRoads(roads, firstRoad, wedgeEnds);
+}
+
+void HoughEventSectors(const EventStore& store, size_t event, const HoughConfig& config, ThreadPool& pool, std::vector<HoughImage>& images, std::vector<Road>& roads){
+
+  std::vector<std::vector<unsigned>> sectors;
+  std::vector<double> phi;
+  phiSectorHits(store, event, config, sectors, phi);
+  std::vector<std::vector<Road>> sectorFound(sectors.size());
+  if (images.size() < pool.size()) images.resize(pool.size());
+  pool.parallelFor(sectors.size(), [&](size_t s, unsigned worker) {
+    sectorRoads(store, event, s, sectors[s], phi, config, images[worker], sectorFound[s]);
+  });
+
+  const size_t firstRoad = roads.size();
+  std::vector<size_t> wedgeEnds;
+  for (size_t s = 0; s < sectors.size(); ++s) {
+    roads.insert(roads.end(), std::make_move_iterator(sectorFound[s].begin()), std::make_move_iterator(sectorFound[s].end()));
+    wedgeEnds.push_back(roads.size());
+  }
+  mergeSectorRoads(roads, firstRoad, wedgeEnds);
+}
+
+void HoughEvent(const EventStore& store, size_t event, const HoughConfig& config, HoughImage& image, std::vector<Road>& roads){
+
+  if (config.m_precision != PRECISION_DOUBLE) {
+    HoughEventPrecision(store, event, config, image, roads);
+    return;
+  }
+  if (config.m_phiSectors > 1) { // each wedge clears the image itself, and only when it has enough doublets
+    houghEventSectors(store, event, config, image, roads);
+    return;
+  }
+  if (image.size(0) != (size_t) config.m_imageSize_x || image.size(1) != (size_t) config.m_imageSize_y) {
+    image = HoughImage(config.m_imageSize_x, config.m_imageSize_y);
+  } else {
+    image.fill();
+  }
+  if (config.m_coarseFactor > 1) {
+    houghEventCoarseToFine(store, event, config, image, roads);
+    return;
+  }
+  FillImage(store, event, config, image);
+  const size_t firstRoad = roads.size();
+  FindRoads(image, event, config, roads);
+  if (config.m_collectHits) CollectRoadHits(store, event, config, roads, firstRoad);
+}
+
+void PrintRoad(const EventStore& store, const Road& road, const HoughConfig& config){
+
+  const double m_step_x = config.stepX();
+  const double m_step_y = config.stepY();
+  const size_t event = road.event;
+  const int x = road.x, y = road.y;
+  cout << " d0: " << xtod0(x, m_step_x, config.m_d0_range) << " truthd0: " << store.d0(event)  << " resolution d0 :" << (store.d0(event) - xtod0(x, m_step_x, config.m_d0_range) )
+       << " q/pt " << ytoqoverpt(y, m_step_y, config.m_qOverPt_range) << " truth q/pT: " << store.charge(event) / store.pt(event)<< " resolution q/pT :" << (store.charge(event) / store.pt(event) - ytoqoverpt(y, m_step_y, config.m_qOverPt_range))<<  endl;
+}
+
+void ProcessEvents(const EventStore& store, const HoughConfig& config, std::vector<Road>& roads){
+
+  HoughImage image(config.m_imageSize_x, config.m_imageSize_y);
+  for(size_t event=0; event<store.nEvents(); event++){
+    HoughEvent(store, event, config, image, roads);
+  }
+}
+
+void ProcessEvents(const EventStore& store, const HoughConfig& config, const std::vector<EventBatch>& batches, std::vector<Road>& roads){
+
+  HoughImage image(config.m_imageSize_x, config.m_imageSize_y);
+  for (size_t batch = 0; batch < batches.size(); ++batch) {
+    for (size_t event = batches[batch].first; event < batches[batch].first + batches[batch].nevents; ++event) {
+      HoughEvent(store, event, config, image, roads);
+    }
   }
-  for (int y = 0; y < m_imageSize_y; y++) {
-    for (int x = 0; x < m_imageSize_x; x++) {
-      // if (passThreshold(image, x, y, m_step_x, m_d0_range, hits, particles) && isLocalMaxima( image, x, y, m_imageSize_x, m_imageSize_y, hits, particles) ) {
-      if (passThreshold(image, x, y, m_step_x, m_d0_range) && isLocalMaxima( image, x, y, m_imageSize_x, m_imageSize_y) ) {
-      // if (passThreshold(image, x, y, m_step_x, m_d0_range) ) {
-        // if (isLocalMaxima( image, x, y, m_imageSize_x, m_imageSize_y)  ) {
-        // cout << image(x, y).second.x << " " << image(x, y).second.r ;
-        cout << " d0: " << xtod0(x, m_step_x, m_d0_range) << " truthd0: " << arr[8]  << " resolution d0 :" << (arr[8] - xtod0(x, m_step_x, m_d0_range) )
-             << " q/pt " << ytoqoverpt(y, m_step_y, m_qOverPt_range) << " truth q/pT: " << arr[6] / arr[7]<< " resolution q/pT :" << (arr[6] / arr[7] - ytoqoverpt(y, m_step_y, m_qOverPt_range))<<  endl;
+}
 
+void ProcessEvents(const EventStore& store, const HoughConfig& config, ThreadPool& pool, size_t batchSize, std::vector<Road>& roads){
+  ProcessEvents(store, config, pool, MakeBatches(store, batchSize), roads);
+}
+
+void ProcessEvents(const EventStore& store, const HoughConfig& config, ThreadPool& pool, const std::vector<EventBatch>& batches, std::vector<Road>& roads){
+
+  if (config.m_latencyTarget_us > 0) { // low latency: one event at a time, its doublets split over the pool
+    if (config.m_coarseFactor > 1) {
+      throw std::invalid_argument("ProcessEvents: the coarse-to-fine search (m_coarseFactor " + std::to_string(config.m_coarseFactor) + ") has no latency mode");
+    }
+    if (config.m_precision != PRECISION_DOUBLE) {
+      throw std::invalid_argument("ProcessEvents: precision " + PrecisionName(config.m_precision) + " has no latency mode");
+    }
+    HoughImage image(config.m_imageSize_x, config.m_imageSize_y);
+    std::vector<HoughImage> slices;
+    for (size_t batch = 0; batch < batches.size(); ++batch) {
+      for (size_t event = batches[batch].first; event < batches[batch].first + batches[batch].nevents; ++event) {
+        if (config.m_phiSectors > 1) {
+          HoughEventSectors(store, event, config, pool, slices, roads);
+          continue;
+        }
+        image.fill();
+        FillImageParallel(store, event, config, pool, IntraEventSlices(store.nHits(event), config, pool.size()), slices, image);
+        const size_t firstRoad = roads.size();
+        FindRoads(image, event, config, roads);
+        if (config.m_collectHits) CollectRoadHits(store, event, config, roads, firstRoad);
       }
     }
+    return;
   }
+
+  const size_t nbatches = batches.size();
+  std::vector<std::vector<Road>> batchRoads(nbatches);
+  std::vector<HoughImage> images(pool.size(), HoughImage(config.m_imageSize_x, config.m_imageSize_y)); // reused by each worker
+
+  pool.parallelFor(nbatches, [&](size_t batch, unsigned worker) {
+    for (size_t event = batches[batch].first; event < batches[batch].first + batches[batch].nevents; ++event) {
+      HoughEvent(store, event, config, images[worker], batchRoads[batch]);
+    }
+  });
+
+  // batches are merged in order, so the result does not depend on the schedule
+  for (size_t batch = 0; batch < nbatches; ++batch) {
+    roads.insert(roads.end(), std::make_move_iterator(batchRoads[batch].begin()), std::make_move_iterator(batchRoads[batch].end()));
+  }
+}
+
+void SelectEvents(const EventStore& store, unsigned nthreads, const HoughConfig& config){
+
+  std::vector<Road> roads;
+  if (nthreads > 1) {
+    ThreadPool pool(nthreads);
+    ProcessEvents(store, config, pool, 16, roads);
+  } else {
+    ProcessEvents(store, config, roads);
+  }
+
+  for (size_t i = 0; i < roads.size(); ++i) {
+    const size_t event = roads[i].event;
+    if (event==1 || event==2 || event == 3) PrintRoad(store, roads[i], config);
+  }
+}
+
+
+void HoughTransform(const EventStore& store, size_t event){
+
+  HoughConfig config;
+  HoughImage image(config.m_imageSize_x, config.m_imageSize_y);
+  std::vector<Road> roads;
+  HoughEvent(store, event, config, image, roads);
+  std::cout << " hits: " << store.nHits(event) <<  std::endl;
+
+  for (size_t i = 0; i < roads.size(); ++i) PrintRoad(store, roads[i], config);
 }
 
 
@@ -12,6 +12,9 @@
 #include <cmath>
 #include <unordered_set>
 #include "plotHelper.h"
+#include "EventStore.h"
+#include "ThreadPool.h"
+#include "EventBatch.h"
 #include <dirent.h>
 #include <cstring>
 #include <stdlib.h>
@@ -23,18 +26,11 @@ using namespace std;
 #ifndef HoughHelper_h
 #define HoughHelper_h
 
-struct hit {
-  double layer[100]; double r[100]; double x[100]; double y[100]; double z[100];
-};
-
-struct particle {
-  double barcode[100]; double charge[100]; double pt[100]; double d0[100];
-};
-
 // ================================================
 // ================================================
 // Definitions for LRT Hough transform
-typedef double fp_t; //  floating point type alias, can change it to float from double
+typedef double fp_t; //  floating point type alias of the runtime rows, builds as float too (the SIMD row kernels then fall back
+                      //  to D0_TABLE); HoughConfig::m_precision picks float or fixed-point rows at run time
 
 typedef std::array<fp_t, 2> pvec;
 pvec operator+(const pvec& a, const pvec& b);
@@ -45,23 +41,193 @@ double length(const pvec& v) ;
 pvec rotate90( const pvec& v);
 double crossProduct( const pvec& a, const pvec& b ) ;
 
-// 2d vector
-void GetInfoFromFile(string mergeFile, std::vector<std::vector<float>>& vec);
-void print_info_vec_data(std::vector<std::vector<float>>& vec, int size);
-void HoughTransform(double *arr);
-bool passThreshold(vector2D<std::pair<int, hit>> &image, int x, int y,  double m_step_x, double m_d0_range);
-bool isLocalMaxima(vector2D<std::pair<int, hit>> &image, int x, int y, int m_imageSize_x, int m_imageSize_y);
-// 1d vector
-void GetInfoFromFile(string mergeFile, std::vector<float>& vec);
-void print_info_vec_data(std::vector<float>& vec, int size);
-void ConvertVecToArr(std::vector<float>& vec, double *arr);
+// How the d0 of a doublet is evaluated in each q/pT row
+enum HoughD0Kernel {
+  D0_REFERENCE = 0, // circle centre built with pvec arithmetic in every row (sqrt, pow, 2 hypot)
+  D0_TABLE,         // row constants from HoughRowTable and the reduced form below (2 sqrt, no pow/hypot)
+  D0_AVX2,          // D0_TABLE, 4 rows per instruction (include/HoughSimd.cxx)
+  D0_AVX512,        // D0_TABLE, 8 rows per instruction
+  D0_SIMD           // widest of the above that the CPU supports, D0_TABLE otherwise
+};
+
+// How the bins of each row segment [xmin, xmax] are incremented
+enum HoughFillMode {
+  FILL_INTERPOLATE = 0, // one increment per bin of the segment
+  FILL_DIFFERENCE       // +1 at xmin and -1 at xmax+1 in a difference array, turned into counts by one prefix sum per fill
+};
+
+// Arithmetic of the doublet terms and the q/pT rows
+enum HoughPrecision {
+  PRECISION_DOUBLE = 0, // the runtime transform below, in fp_t
+  PRECISION_FLOAT,      // HoughEngine 216x216-float (include/HoughEngine.cxx)
+  PRECISION_FIXED20,    // HoughEngine 216x216-fixed36.20
+  PRECISION_FIXED12,    // HoughEngine 216x216-fixed36.12
+  PRECISION_FIXED6      // HoughEngine 216x216-fixed36.6
+};
+
+// Parameters of the doublet Hough transform
+struct HoughConfig {
+  double m_acceptedDistanceBetweenLayersMin; // min R disstance for hits pair filtering
+  double m_acceptedDistanceBetweenLayersMax;
+  float m_d0_range;
+  float m_qOverPt_range;
+  int m_imageSize_x; // i.e. number of bins in d0
+  int m_imageSize_y; // i.e. number of bins in q/pT
+  bool m_continuous; // assure that there is continuity of the line (i.e. middle bins in d0 are filled when one q/pT step would result in a hole)
+  int m_threshold;   // min number of doublets in a bin with |d0| >= 50
+  int m_threshold50; // min number of doublets in a bin with |d0| < 50
+  double m_latencyTarget_us; // per-event latency target; > 0 splits the doublets of each event over the pool
+  double m_pairCost_ns;      // estimated serial cost of one candidate hit pair, used against the latency target
+  bool m_collectHits;        // recover the hits of every road with a second pass over the event's doublets
+  HoughD0Kernel m_d0Kernel;
+  HoughFillMode m_fillMode;
+  int m_coarseFactor;    // > 1: coarse-to-fine search, first on a grid m_coarseFactor times coarser in d0 and q/pT (must divide the image size)
+  int m_coarseThreshold; // doublets a coarse cell needs to be refined at full resolution, 0 for min(m_threshold, m_threshold50)
+  int m_phiSectors;      // > 1: the hits are split in that many phi wedges and each wedge is transformed on its own
+  double m_phiOverlap;   // [rad] each wedge extends this far into its neighbours
+  float m_z0Window;   // [mm] > 0: r-z pre-filter, the line through the two hits of a doublet in r-z must cross r = 0 within |z| < m_z0Window
+  float m_detaWindow; // > 0: r-z pre-filter, the two hits of a doublet must be within m_detaWindow in eta
+  HoughPrecision m_precision; // other than PRECISION_DOUBLE: HoughEvent runs the HoughEngine of that precision (216x216 binning, default ranges, no sectors or coarse-to-fine)
+
+  HoughConfig();
+  double stepX() const { return (2*m_d0_range) / m_imageSize_x; } // helpers (accumulator granularity)
+  double stepY() const { return (2*m_qOverPt_range) / m_imageSize_y; }
+};
+
+// Constants of the q/pT rows for one configuration, index y as in the accumulator
+struct HoughRowTable {
+  std::vector<fp_t> qoverpt;   // -(y*step + step/2 - range)
+  std::vector<fp_t> radius;    // 1/(0.6*qoverpt)
+  std::vector<fp_t> radius2;   // radius^2
+  std::vector<fp_t> absRadius; // |radius|
+  std::vector<fp_t> sign;      // sign of radius
+
+  explicit HoughRowTable(const HoughConfig& config);
+};
+// table of the given configuration, cached per thread for the last few q/pT binnings (the coarse and the
+// fine grid of a coarse-to-fine search alternate)
+const HoughRowTable& RowTable(const HoughConfig& config);
+
+// hit pair passing the pair selection (different layers, m_acceptedDistanceBetweenLayersMin < R2-R1 <
+// m_acceptedDistanceBetweenLayersMax, and the r-z windows when they are set), with the chord terms every
+// q/pT row needs
+struct Doublet {
+  unsigned hit1, hit2; // store indices, hit1 < hit2
+  pvec mid;            // p1 + half
+  pvec half;           // (p2-p1)/2, its length is the half-length of the chord
+};
+Doublet MakeDoublet(const pvec& p1, const pvec& p2, unsigned hit1 = 0, unsigned hit2 = 0);
+// doublets of the event whose first hit is in [firstHit, lastHit), replacing the (i, j) all-pairs loop:
+// the hits are bucketed by layer and sorted by radius, so each hit only visits the hits of the other
+// layers inside its radius window and the work grows with the number of doublets rather than n^2
+void MakeDoublets(const EventStore& store, size_t event, size_t firstHit, size_t lastHit, const HoughConfig& config, std::vector<Doublet>& doublets);
+// the same for a subset of the hits of one event (store indices, increasing)
+void MakeDoublets(const EventStore& store, const std::vector<unsigned>& hits, const HoughConfig& config, std::vector<Doublet>& doublets);
+
+// d0 bin of the doublet (p1, p2) in every q/pT row y in [1, m_imageSize_y), -1 where it is outside
+// the image. With m = (p1+p2)/2, h = (p2-p1)/2 and u = rotate90(h) the circle centre is
+// m + u*sign(R)*sqrt(R^2-|h|^2)/|h|, so
+//   |centre|^2 - R^2 = A + t,  A = |m|^2 - |h|^2,  t = sign(R)*2*(m.u)/|h|*sqrt(R^2-|h|^2)
+//   d0 = sign(R)*(|centre| - |R|) = sign(R)*(A + t)/(sqrt(A + R^2 + t) + |R|)
+// which D0_TABLE evaluates with A and 2*(m.u)/|h| computed once per doublet.
+void DoubletBins(const Doublet& doublet, const HoughConfig& config, int* xbins);
+
+// per-doublet terms of the reduced d0, shared by the scalar and SIMD row loops so they round the same way
+struct DoubletTerms {
+  fp_t A;  // |m|^2 - |h|^2
+  fp_t B;  // 2*(m.u)/|h|
+  fp_t h2; // |h|^2
+};
+DoubletTerms GetDoubletTerms(const Doublet& doublet);
+// scalar D0_TABLE rows [firstRow, m_imageSize_y)
+void DoubletBinsRows(const DoubletTerms& terms, const HoughRowTable& rows, const HoughConfig& config, int firstRow, int* xbins);
+// SIMD rows from 1 on, as many as fill whole vectors; return the first row left to the scalar loop
+int DoubletBinsAVX2(const DoubletTerms& terms, const HoughRowTable& rows, const HoughConfig& config, int* xbins);
+int DoubletBinsAVX512(const DoubletTerms& terms, const HoughRowTable& rows, const HoughConfig& config, int* xbins);
+// D0_AVX2/D0_AVX512 are only usable when the CPU has the instructions; D0_SIMD resolves to the widest one
+bool CpuSupports(HoughD0Kernel kernel);
+HoughD0Kernel ResolveD0Kernel(HoughD0Kernel kernel);
+
+// accumulator: number of doublets per (d0, q/pT) bin, nothing else, so that the 216x216 image
+// is ~90 kB and stays in L2. Counts saturate at HOUGHCOUNT_MAX.
+typedef uint16_t HoughCount;
+#define HOUGHCOUNT_MAX 65535
+typedef vector2D<HoughCount> HoughImage;
+
+// bin above threshold that no neighbour in its 3x3 neighbourhood exceeds
+struct HoughPeak {
+  int x;     // d0 bin
+  int y;     // q/pT bin
+  int count; // doublets in the bin
+};
+
+// local maximum of the accumulator above threshold
+struct Road {
+  size_t event;
+  int x;     // d0 bin
+  int y;     // q/pT bin
+  int count; // doublets in the bin
+  std::vector<unsigned> hits; // store indices, sorted (filled by CollectRoadHits)
+};
+
 void print_info_array_data(double *arr, unsigned int size);
-void SelectEvent(double *arr, unsigned int size);
-// old way
-void GetInfoFromFiles(string hitsFile, string partsFile, hit *hits, particle *particles, int nevents);
-void printout_struct(hit *hits, particle *particles);
-bool passThreshold(vector2D<std::pair<int, hit>> &image, int x, int y,  double m_step_x, double m_d0_range, hit *hits, particle *particles);
-bool isLocalMaxima(vector2D<std::pair<int, hit>> &image, int x, int y, int m_imageSize_x, int m_imageSize_y,hit *hits, particle *particles) ;
-void SelectEvents(hit *hits, particle *particles, int nevents) ;
+void FillImage(const EventStore& store, size_t event, const HoughConfig& config, HoughImage& image);
+// doublets whose first hit is in [firstHit, lastHit), a slice of the event's doublet space
+void FillImage(const EventStore& store, size_t event, size_t firstHit, size_t lastHit, const HoughConfig& config, HoughImage& image);
+// number of slices needed to meet config.m_latencyTarget_us for an event with nhits
+unsigned IntraEventSlices(size_t nhits, const HoughConfig& config, unsigned maxSlices);
+// the doublet space of one event split in nslices with the same number of hit pairs, each filled
+// into a private accumulator on the pool, then summed into image row by row (same result as FillImage)
+void FillImageParallel(const EventStore& store, size_t event, const HoughConfig& config, ThreadPool& pool, unsigned nslices,
+                       std::vector<HoughImage>& slices, HoughImage& image);
+bool passThreshold(HoughImage &image, int x, int y, const HoughConfig& config);
+bool isLocalMaxima(HoughImage &image, int x, int y, int m_imageSize_x, int m_imageSize_y);
+// threshold and 3x3 maximum in one pass over the accumulator, streaming the d0 columns in memory order:
+// the maximum is separable (along q/pT in each column, then across three neighbouring columns), so each
+// bin is read once. Same peaks as passThreshold + isLocalMaxima, ordered by q/pT row then d0 bin.
+void FindPeaks(const HoughImage& image, const HoughConfig& config, std::vector<HoughPeak>& peaks);
+void FindRoads(HoughImage& image, size_t event, const HoughConfig& config, std::vector<Road>& roads);
+// on-demand membership: walks the event's doublets again and gives each road the hits of the
+// doublets whose line goes through its bin (roads[firstRoad...] must all belong to event)
+void CollectRoadHits(const EventStore& store, size_t event, const HoughConfig& config, std::vector<Road>& roads, size_t firstRoad = 0);
+// fill + roads of one event, the image is cleared first so it can be reused across events. With
+// m_coarseFactor > 1 the doublets are first filled into the coarse grid; only the doublets that cross a
+// coarse cell above m_coarseThreshold or one of its neighbours are filled at full resolution, in those coarse
+// rows only, and only the peaks inside such cells are kept. The rows are the D0_TABLE ones whatever m_d0Kernel
+// and m_fillMode say; ./benchmark coarse checks the roads against the flat fill.
+void HoughEvent(const EventStore& store, size_t event, const HoughConfig& config, HoughImage& image, std::vector<Road>& roads);
+// HoughEvent with m_precision other than PRECISION_DOUBLE: the compiled-in HoughEngine of that precision
+// (include/HoughEngine.cxx, one per thread) with the runtime parameters of config; throws invalid_argument
+// when config asks for a binning, ranges, sectors or coarse-to-fine that the engine does not have
+void HoughEventPrecision(const EventStore& store, size_t event, const HoughConfig& config, HoughImage& image, std::vector<Road>& roads);
+// option names: double, float, fixed36.20, fixed36.12, fixed36.6; ParsePrecision throws invalid_argument for any other
+std::string PrecisionName(HoughPrecision precision);
+HoughPrecision ParsePrecision(const std::string& name);
+// Phi sectors: wedge s is centred at -pi + (s + 1/2)*2pi/m_phiSectors and takes the hits within half a wedge
+// plus m_phiOverlap of its centre (GetPhi), so a hit near a border is in two wedges. Each wedge has its own
+// hit list, doublets and accumulator; only pairs of hits of the same wedge are doublets, which drops the
+// combinatorics between tracks far apart in phi. The roads of all wedges are merged: a bin found in several
+// wedges (a track in an overlap) is one road, the one with the highest count. HoughEvent runs the wedges one
+// after the other when m_phiSectors > 1 (with the flat fill whatever m_coarseFactor and m_fillMode say); the image
+// is then the scratch accumulator of the wedges and only cleared for a wedge with enough doublets.
+// store indices of the hits of every wedge of the event, increasing
+void PhiSectorHits(const EventStore& store, size_t event, const HoughConfig& config, std::vector<std::vector<unsigned>>& sectors);
+// the wedges of one event run in parallel on the pool, one accumulator per worker (images is resized to the
+// pool); same roads as HoughEvent
+void HoughEventSectors(const EventStore& store, size_t event, const HoughConfig& config, ThreadPool& pool, std::vector<HoughImage>& images, std::vector<Road>& roads);
+void PrintRoad(const EventStore& store, const Road& road, const HoughConfig& config);
+
+// all events, or the events of batches, roads in event order
+void ProcessEvents(const EventStore& store, const HoughConfig& config, std::vector<Road>& roads);
+void ProcessEvents(const EventStore& store, const HoughConfig& config, const std::vector<EventBatch>& batches, std::vector<Road>& roads);
+// events scheduled in batches on the pool, one accumulator per worker, roads merged in event order;
+// with a latency target the events run one after the other, each one split over the pool (in phi
+// sectors when m_phiSectors > 1); the coarse-to-fine search is not split, so m_coarseFactor > 1 with a
+// latency target throws std::invalid_argument
+void ProcessEvents(const EventStore& store, const HoughConfig& config, ThreadPool& pool, size_t batchSize, std::vector<Road>& roads);
+void ProcessEvents(const EventStore& store, const HoughConfig& config, ThreadPool& pool, const std::vector<EventBatch>& batches, std::vector<Road>& roads);
+
+void HoughTransform(const EventStore& store, size_t event);
+void SelectEvents(const EventStore& store, unsigned nthreads = 1, const HoughConfig& config = HoughConfig());
 
 #endif
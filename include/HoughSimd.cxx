@@ -0,0 +1,88 @@
+#include <immintrin.h>
+#include "HoughHelper.h"
+#ifndef HoughSimd_cxx
+#define HoughSimd_cxx
+
+// The SIMD rows must round exactly like DoubletBinsRows: no a*b+c contracted into an FMA,
+// which the avx512f target would otherwise allow
+#pragma GCC optimize ("fp-contract=off")
+
+using namespace std;
+
+// ================================================
+// ================================================
+// D0_TABLE evaluated on several q/pT rows at once.
+// Same operations in the same order as the scalar loop, so every row lands in the same bin;
+// rows with no circle through both hits or a d0 outside the image get -1.
+// The arithmetic is double: with fp_t = float the row tables are widened on load so that this still
+// builds, and CpuSupports never offers these kernels (the scalar float rows would round differently).
+
+__attribute__((target("avx2")))
+static inline __m256d loadRows4(const double* p) { return _mm256_loadu_pd(p); }
+__attribute__((target("avx2")))
+static inline __m256d loadRows4(const float* p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+__attribute__((target("avx512f")))
+static inline __m512d loadRows8(const double* p) { return _mm512_loadu_pd(p); }
+__attribute__((target("avx512f")))
+static inline __m512d loadRows8(const float* p) { return _mm512_cvtps_pd(_mm256_loadu_ps(p)); }
+
+__attribute__((target("avx2")))
+int DoubletBinsAVX2(const DoubletTerms& terms, const HoughRowTable& rows, const HoughConfig& config, int* xbins){
+
+  const __m256d h2 = _mm256_set1_pd(terms.h2);
+  const __m256d A = _mm256_set1_pd(terms.A);
+  const __m256d B = _mm256_set1_pd(terms.B);
+  const __m256d range = _mm256_set1_pd(config.m_d0_range);
+  const __m256d step = _mm256_set1_pd(config.stepX());
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d xmax = _mm256_set1_pd(config.m_imageSize_x);
+  const __m256d none = _mm256_set1_pd(-1.0);
+
+  int y = 1;
+  for ( ; y + 4 <= config.m_imageSize_y; y += 4 ) {
+    const __m256d R2 = loadRows4(&rows.radius2[y]);
+    const __m256d sign = loadRows4(&rows.sign[y]);
+    const __m256d t = _mm256_mul_pd(_mm256_mul_pd(sign, B), _mm256_sqrt_pd(_mm256_sub_pd(R2, h2)));
+    const __m256d num = _mm256_mul_pd(sign, _mm256_add_pd(A, t));
+    const __m256d den = _mm256_add_pd(_mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(A, R2), t)), loadRows4(&rows.absRadius[y]));
+    const __m256d x = _mm256_div_pd(_mm256_add_pd(_mm256_div_pd(num, den), range), step);
+    // ordered compares, so the NaN of rows with R2 <= h2 fails them as well
+    const __m256d inside = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(R2, h2, _CMP_GT_OQ), _mm256_cmp_pd(x, one, _CMP_GE_OQ)),
+                                         _mm256_cmp_pd(x, xmax, _CMP_LT_OQ));
+    _mm_storeu_si128((__m128i*)(xbins + y), _mm256_cvttpd_epi32(_mm256_blendv_pd(none, x, inside)));
+  }
+  return y;
+}
+
+// _mm512_sqrt_pd starts from _mm512_undefined_pd, which g++ 12 reports as maybe-uninitialized
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+int DoubletBinsAVX512(const DoubletTerms& terms, const HoughRowTable& rows, const HoughConfig& config, int* xbins){
+
+  const __m512d h2 = _mm512_set1_pd(terms.h2);
+  const __m512d A = _mm512_set1_pd(terms.A);
+  const __m512d B = _mm512_set1_pd(terms.B);
+  const __m512d range = _mm512_set1_pd(config.m_d0_range);
+  const __m512d step = _mm512_set1_pd(config.stepX());
+  const __m512d one = _mm512_set1_pd(1.0);
+  const __m512d xmax = _mm512_set1_pd(config.m_imageSize_x);
+  const __m256i none = _mm256_set1_epi32(-1);
+
+  int y = 1;
+  for ( ; y + 8 <= config.m_imageSize_y; y += 8 ) {
+    const __m512d R2 = loadRows8(&rows.radius2[y]);
+    const __m512d sign = loadRows8(&rows.sign[y]);
+    const __m512d t = _mm512_mul_pd(_mm512_mul_pd(sign, B), _mm512_sqrt_pd(_mm512_sub_pd(R2, h2)));
+    const __m512d num = _mm512_mul_pd(sign, _mm512_add_pd(A, t));
+    const __m512d den = _mm512_add_pd(_mm512_sqrt_pd(_mm512_add_pd(_mm512_add_pd(A, R2), t)), loadRows8(&rows.absRadius[y]));
+    const __m512d x = _mm512_div_pd(_mm512_add_pd(_mm512_div_pd(num, den), range), step);
+    const __mmask8 inside = _mm512_cmp_pd_mask(R2, h2, _CMP_GT_OQ) & _mm512_cmp_pd_mask(x, one, _CMP_GE_OQ)
+                          & _mm512_cmp_pd_mask(x, xmax, _CMP_LT_OQ);
+    _mm256_storeu_si256((__m256i*)(xbins + y), _mm512_mask_cvttpd_epi32(none, inside, x));
+  }
+  return y;
+}
+#pragma GCC diagnostic pop
+
+#endif
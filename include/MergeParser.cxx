@@ -0,0 +1,184 @@
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include "MergeParser.h"
+#ifndef MergeParser_cxx
+#define MergeParser_cxx
+
+using namespace std;
+
+// Hits of one event inside a chunk, truth is taken from its first line
+struct EventRun {
+  int event;
+  size_t nhits;
+  float charge, pt, d0;
+};
+
+struct ParsedChunk {
+  std::vector<EventRun> runs;
+  std::vector<int32_t> layer;
+  std::vector<float> r, x, y, z;
+  std::string error;
+};
+
+static inline const char* skipBlanks(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r')) ++p;
+  return p;
+}
+
+static inline bool parseField(const char*& p, const char* end, float& value) {
+  p = skipBlanks(p, end);
+#if defined(__cpp_lib_to_chars)
+  std::from_chars_result res = std::from_chars(p, end, value);
+  if (res.ec != std::errc()) return false;
+  p = res.ptr;
+#else
+  // older libstdc++ has no floating point from_chars
+  char* next;
+  value = std::strtof(p, &next);
+  if (next == p || next > end) return false;
+  p = next;
+#endif
+  return true;
+}
+
+static inline bool parseField(const char*& p, const char* end, int& value) {
+  p = skipBlanks(p, end);
+  std::from_chars_result res = std::from_chars(p, end, value);
+  if (res.ec != std::errc()) return false;
+  p = res.ptr;
+  return true;
+}
+
+// blank lines and comment or header lines (first field starting with '#' or a letter) carry no hit
+static inline bool isSkippedLine(const char* p, const char* eol) {
+  p = skipBlanks(p, eol);
+  return p == eol || *p == '#' || std::isalpha((unsigned char) *p);
+}
+
+// base is the start of the whole buffer, for the byte offsets in the errors
+static void parseChunk(const char* base, const char* begin, const char* end, ParsedChunk& chunk) {
+  // rough reservation, a merge.txt line is ~60 characters
+  const size_t guess = (end - begin) / 50;
+  chunk.layer.reserve(guess); chunk.r.reserve(guess); chunk.x.reserve(guess); chunk.y.reserve(guess); chunk.z.reserve(guess);
+
+  const char* p = begin;
+  while (p < end) {
+    const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    if (!eol) eol = end;
+
+    int event;
+    float layer, r, x, y, z, charge, pt, d0, numhits;
+    const char* q = p;
+    if (parseField(q, eol, event) && parseField(q, eol, layer) && parseField(q, eol, r) && parseField(q, eol, x) &&
+        parseField(q, eol, y) && parseField(q, eol, z) && parseField(q, eol, charge) && parseField(q, eol, pt) &&
+        parseField(q, eol, d0) && parseField(q, eol, numhits) && skipBlanks(q, eol) == eol) {
+      if (event < 0) { chunk.error = "negative event id at byte " + std::to_string(p - base); return; }
+      if (chunk.runs.empty() || chunk.runs.back().event != event) {
+        if (!chunk.runs.empty() && event < chunk.runs.back().event) { chunk.error = "events are not sorted at byte " + std::to_string(p - base); return; }
+        EventRun run = { event, 0, charge, pt, d0 };
+        chunk.runs.push_back(run);
+      }
+      chunk.runs.back().nhits++;
+      chunk.layer.push_back(layer);
+      chunk.r.push_back(r); chunk.x.push_back(x); chunk.y.push_back(y); chunk.z.push_back(z);
+    } else if (!isSkippedLine(p, eol)) {
+      chunk.error = "malformed line at byte " + std::to_string(p - base);
+      return;
+    }
+    p = eol + 1;
+  }
+}
+
+template <typename T>
+static void append(std::vector<T>& to, const std::vector<T>& from) {
+  to.insert(to.end(), from.begin(), from.end());
+}
+
+void ParseMergeBuffer(const char* begin, const char* end, EventColumns& cols, unsigned nthreads) {
+  if (nthreads == 0) nthreads = 1;
+
+  // chunk boundaries, each one moved forward to the start of the next line
+  std::vector<const char*> bounds(1, begin);
+  for (unsigned t = 1; t < nthreads; ++t) {
+    const char* cut = begin + (end - begin) * t / nthreads;
+    if (cut < bounds.back()) cut = bounds.back();
+    const char* eol = static_cast<const char*>(std::memchr(cut, '\n', end - cut));
+    bounds.push_back(eol ? eol + 1 : end);
+  }
+  bounds.push_back(end);
+
+  std::vector<ParsedChunk> chunks(nthreads);
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < nthreads; ++t) workers.push_back(std::thread(parseChunk, begin, bounds[t], bounds[t+1], std::ref(chunks[t])));
+  parseChunk(begin, bounds[0], bounds[1], chunks[0]);
+  for (size_t t = 0; t < workers.size(); ++t) workers[t].join();
+
+  // stitch in order
+  cols = EventColumns();
+  size_t nhits = 0;
+  for (size_t t = 0; t < chunks.size(); ++t) {
+    if (!chunks[t].error.empty()) throw std::runtime_error("ParseMergeBuffer: " + chunks[t].error);
+    nhits += chunks[t].layer.size();
+  }
+  cols.layer.reserve(nhits); cols.r.reserve(nhits); cols.x.reserve(nhits); cols.y.reserve(nhits); cols.z.reserve(nhits);
+  cols.offsets.push_back(0);
+
+  for (size_t t = 0; t < chunks.size(); ++t) {
+    const ParsedChunk& chunk = chunks[t];
+    for (size_t k = 0; k < chunk.runs.size(); ++k) {
+      const EventRun& run = chunk.runs[k];
+      if (run.event < (int) cols.nEvents() - 1) { // only the first run of a chunk can go back, the chunk checked the others
+        throw std::runtime_error("ParseMergeBuffer: events are not sorted, event " + std::to_string(run.event) +
+                                 " in the chunk starting at byte " + std::to_string(bounds[t] - begin));
+      }
+      // events without hits get an empty range and zero truth
+      while ((int) cols.nEvents() <= run.event) {
+        cols.offsets.push_back(cols.offsets.back());
+        cols.charge.push_back(0); cols.pt.push_back(0); cols.d0.push_back(0);
+      }
+      if (cols.offsets[run.event+1] == cols.offsets[run.event]) { // an event split across two chunks keeps its first truth
+        cols.charge[run.event] = run.charge; cols.pt[run.event] = run.pt; cols.d0[run.event] = run.d0;
+      }
+      cols.offsets[run.event+1] += run.nhits;
+    }
+    append(cols.layer, chunk.layer);
+    append(cols.r, chunk.r); append(cols.x, chunk.x); append(cols.y, chunk.y); append(cols.z, chunk.z);
+  }
+}
+
+void ParseMergeText(const string& mergeFile, EventColumns& cols, unsigned nthreads) {
+  int fd = open(mergeFile.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("ParseMergeText: cannot open " + mergeFile);
+  struct stat st;
+  if (fstat(fd, &st) != 0) { close(fd); throw std::runtime_error("ParseMergeText: cannot stat " + mergeFile); }
+  if (st.st_size == 0) { close(fd); cols = EventColumns(); cols.offsets.push_back(0); return; }
+
+  void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) throw std::runtime_error("ParseMergeText: cannot map " + mergeFile);
+  madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+  const char* begin = static_cast<const char*>(base);
+  try {
+    ParseMergeBuffer(begin, begin + st.st_size, cols, nthreads);
+  } catch (...) {
+    munmap(base, st.st_size);
+    throw;
+  }
+  munmap(base, st.st_size);
+}
+
+unsigned DefaultThreads() {
+  unsigned n = std::thread::hardware_concurrency();
+  return n ? n : 1;
+}
+
+#endif
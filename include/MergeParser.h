@@ -0,0 +1,21 @@
+#include <string>
+#include <vector>
+#include "EventFormat.h"
+using namespace std;
+
+#ifndef MergeParser_h
+#define MergeParser_h
+
+// ================================================
+// ================================================
+// Chunked parallel parser for merged text files
+// (event layer r x y z charge pt d0 numhits, one hit per line, events sorted).
+// The buffer is cut into nthreads chunks on line boundaries, every chunk is parsed
+// on its own thread and the per-event results are stitched back in file order.
+// Blank lines and lines starting with '#' or a letter (headers) are skipped; any other line that does not
+// hold the ten fields, or a negative event id, throws std::runtime_error with its byte offset.
+void ParseMergeText(const string& mergeFile, EventColumns& cols, unsigned nthreads);
+void ParseMergeBuffer(const char* begin, const char* end, EventColumns& cols, unsigned nthreads);
+unsigned DefaultThreads();
+
+#endif
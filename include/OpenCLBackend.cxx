@@ -0,0 +1,300 @@
+#include "OpenCLBackend.h"
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <unistd.h>
+
+#ifndef OpenCLBackend_cxx
+#define OpenCLBackend_cxx
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// profiling info of a finished command
+static CommandTiming commandTiming(const cl::Event& event, DeviceCommand command, unsigned cu, const EventBatch& batch, size_t b, size_t bytes) {
+  CommandTiming timing;
+  timing.command = command;
+  timing.cu = cu;
+  timing.batch = b;
+  timing.nevents = batch.nevents;
+  timing.bytes = bytes;
+  timing.queued = event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+  timing.submit = event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+  timing.start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+  timing.end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+  return timing;
+}
+
+// buffer in DDR bank `bank` of the card, whatever kernel argument it is bound to later
+static cl::Buffer bankBuffer(const cl::Context& context, cl_mem_flags flags, size_t size, unsigned bank) {
+  cl_int err;
+  cl_mem_ext_ptr_t ext;
+  ext.flags = bank | XCL_MEM_TOPOLOGY;
+  ext.obj = NULL;
+  ext.param = 0;
+  return cl::Buffer(context, flags | CL_MEM_EXT_PTR_XILINX, size, &ext, &err);
+}
+
+StageTimes& StageTimes::operator+=(const StageTimes& other) {
+  pack += other.pack;
+  hough += other.hough;
+  waitDevice += other.waitDevice;
+  return *this;
+}
+
+OpenCLBackend::OpenCLBackend(const std::string& kernelName, const std::string& binaryFile, const HoughConfig& config, unsigned ncu, size_t depth, size_t nprint)
+  : m_config(config), m_ncu(std::max(1u, ncu)), m_depth(std::max<size_t>(2, depth)), m_nprint(nprint), m_nevents(0), m_wireBytes(0), m_blockBytes(0) {
+
+  if (kernelName != "select" && kernelName != "hough") throw std::runtime_error("OpenCLBackend: unknown kernel " + kernelName + ", use select or hough");
+  m_houghOnCard = (kernelName == "hough");
+  // the card only returns the bins, and the hits tk keeps are not store indices: no hits in the roads
+  m_config.m_collectHits = false;
+
+  // Initialize the OpenCL environment
+  cl_int err;
+  unsigned fileBufSize;
+  std::vector<cl::Device> devices = get_xilinx_devices();
+  devices.resize(1);
+  m_device = devices[0];
+  m_context = cl::Context(m_device, NULL, NULL, NULL, &err);
+  char *fileBuf = read_binary_file(!binaryFile.empty() ? binaryFile : (m_houghOnCard ? "tkHough.xclbin" : "tk.xclbin"), fileBufSize);
+  cl::Program::Binaries bins{{fileBuf, fileBufSize}};
+  m_program = cl::Program(m_context, devices, bins, NULL, &err);
+  delete[] fileBuf;
+}
+
+void OpenCLBackend::run(const EventStore& events, const std::vector<EventBatch>& batches, std::vector<Road>& roads){
+
+  cl_int err;
+  const unsigned ncu = m_ncu;
+  const size_t depth = m_depth;
+  const bool houghOnCard = m_houghOnCard;
+  const HoughConfig& config = m_config;
+  size_t maxEventsPerBatch = 1;
+  for (size_t b = 0; b < batches.size(); b++) maxEventsPerBatch = std::max(maxEventsPerBatch, batches[b].nevents);
+  const size_t maxHits = std::max<size_t>(1, MaxBatchHits(batches));
+  const size_t outBytes = houghOnCard ? sizeof(WireRoad) * WIREROAD_MAX_PER_EVENT * maxEventsPerBatch : sizeof(WireHit) * maxHits;
+
+  // One out-of-order queue per CU and `depth` sets of buffers per CU in its DDR bank, sized for the largest
+  // batch and mapped once. The kernel object of a slot names its CU ("tk:{tk2}"), so its commands only
+  // ever run there, next to the buffers.
+  std::vector<cl::CommandQueue> queues(ncu);
+  std::vector<std::vector<PipelineSlot>> slots(ncu, std::vector<PipelineSlot>(depth));
+  for (unsigned cu = 0; cu < ncu; cu++) {
+    cl::CommandQueue& q = queues[cu];
+    q = cl::CommandQueue(m_context, m_device, CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err);
+    const unsigned bank = cu % DDR_BANKS;
+    const std::string kernelName = houghOnCard ? "tkHough" : "tk";
+    const std::string cuName = kernelName + ":{" + kernelName + std::to_string(cu + 1) + "}";
+    for (size_t s = 0; s < depth; s++) {
+      PipelineSlot& slot = slots[cu][s];
+      slot.kernel = cl::Kernel(m_program, cuName.c_str(), &err);
+      slot.in_buff = bankBuffer(m_context, CL_MEM_READ_ONLY, sizeof(WireHit) * maxHits, bank);
+      slot.out_buff = bankBuffer(m_context, CL_MEM_WRITE_ONLY, outBytes, bank);
+      slot.offsets_buff = bankBuffer(m_context, CL_MEM_READ_ONLY, sizeof(uint32_t) * (maxEventsPerBatch + 1), bank);
+      slot.counts_buff = bankBuffer(m_context, CL_MEM_WRITE_ONLY, sizeof(uint32_t) * (maxEventsPerBatch + 1), bank);
+      slot.input = (WireHit *)q.enqueueMapBuffer(slot.in_buff, CL_TRUE, CL_MAP_WRITE, 0, sizeof(WireHit) * maxHits);
+      if (houghOnCard) slot.found.resize(WIREROAD_MAX_PER_EVENT * maxEventsPerBatch);
+      else slot.output.resize(maxHits);
+      slot.offsets = (uint32_t *)q.enqueueMapBuffer(slot.offsets_buff, CL_TRUE, CL_MAP_WRITE, 0, sizeof(uint32_t) * (maxEventsPerBatch + 1));
+      slot.counts = (uint32_t *)q.enqueueMapBuffer(slot.counts_buff, CL_TRUE, CL_MAP_READ, 0, sizeof(uint32_t) * (maxEventsPerBatch + 1));
+      slot.kernel.setArg(0, slot.in_buff);
+      slot.kernel.setArg(1, slot.out_buff);
+      slot.kernel.setArg(2, slot.offsets_buff);
+      slot.kernel.setArg(3, slot.counts_buff);
+      slot.kernel.setArg(5, config.m_z0Window);
+      slot.kernel.setArg(6, config.m_detaWindow);
+    }
+  }
+
+  // per driver thread (CU, slot), summed at the end
+  std::vector<StageTimes> times(ncu * depth);
+  std::vector<size_t> nevents(ncu * depth, 0), wireBytes(ncu * depth, 0);
+  m_profile.clear();
+  std::vector<HoughImage> images(ncu * depth, HoughImage(config.m_imageSize_x, config.m_imageSize_y));
+  std::mutex printing;
+
+  BatchDispatcher dispatcher(ncu, depth);
+  dispatcher.run(batches.size(), [&](unsigned cu, unsigned s, size_t b, std::vector<Road>& found) {
+    PipelineSlot& slot = slots[cu][s];
+    cl::CommandQueue& q = queues[cu];
+    const size_t d = cu * depth + s;
+    StageTimes& t = times[d];
+
+    // WireHits of every event, written straight from the store columns
+    std::chrono::steady_clock::time_point packStart = std::chrono::steady_clock::now();
+    const EventBatch& batch = batches[b];
+    slot.batch = b;
+    PackEventBatch(events, batch, slot.input, slot.offsets);
+    slot.kernel.setArg(4, (cl_uint) batch.nevents);
+    t.pack += secondsSince(packStart);
+
+    // transfer of inputs to device memory, execution of kernel and transfer of the count table back to
+    // host memory, each one waiting for the previous one only; the other slots of the CU keep it busy meanwhile
+    q.enqueueMigrateMemObjects({slot.in_buff, slot.offsets_buff}, 0, NULL, &slot.written); // 0 means from host
+    std::vector<cl::Event> afterWrite(1, slot.written);
+    q.enqueueTask(slot.kernel, &afterWrite, &slot.computed);
+    std::vector<cl::Event> afterKernel(1, slot.computed);
+    q.enqueueMigrateMemObjects({slot.counts_buff}, CL_MIGRATE_MEM_OBJECT_HOST, &afterKernel, &slot.counted);
+    q.flush();
+
+    // the count table tells how many kept hits (roads) to read back
+    std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+    slot.counted.wait();
+    const size_t nout = slot.counts[batch.nevents];
+    const size_t readBytes = nout * (houghOnCard ? sizeof(WireRoad) : sizeof(WireHit));
+    void *readTo = houghOnCard ? (void *) slot.found.data() : (void *) slot.output.data();
+    if (nout > 0) q.enqueueReadBuffer(slot.out_buff, CL_TRUE, 0, readBytes, readTo, NULL, &slot.read);
+    t.waitDevice += secondsSince(waitStart);
+    m_profile.add(commandTiming(slot.written, COMMAND_WRITE, cu, batch, b, sizeof(WireHit) * batch.nhits + sizeof(uint32_t) * (batch.nevents + 1)));
+    m_profile.add(commandTiming(slot.computed, COMMAND_KERNEL, cu, batch, b, 0));
+    m_profile.add(commandTiming(slot.counted, COMMAND_COUNTS, cu, batch, b, sizeof(uint32_t) * (batch.nevents + 1)));
+    if (nout > 0) m_profile.add(commandTiming(slot.read, COMMAND_READ, cu, batch, b, readBytes));
+    wireBytes[d] += WireBatchBytes(batch, readBytes);
+
+    std::chrono::steady_clock::time_point houghStart = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < batch.nevents; k++) {
+      const size_t i = batch.first + k;
+      const size_t firstRoad = found.size();
+      if (houghOnCard) {
+        const WireRoad *first = slot.found.data() + slot.counts[k], *last = slot.found.data() + slot.counts[k+1];
+        if (last - first == 1 && (first->flags & WIREROAD_OVERFLOW)) {
+          HoughEvent(events, i, config, images[d], found); // too large for the card
+        } else {
+          for (const WireRoad *r = first; r != last; ++r) {
+            Road road;
+            road.event = i;
+            road.x = r->x;
+            road.y = r->y;
+            road.count = r->count;
+            found.push_back(road);
+          }
+        }
+        if (i < m_nprint) {
+          std::lock_guard<std::mutex> lock(printing);
+          std::cout << " hits: " << events.nHits(i) << std::endl;
+          for (size_t r = firstRoad; r < found.size(); ++r) PrintRoad(events, found[r], config);
+        }
+      } else {
+        const WireHit *eventOutput = slot.output.data() + slot.counts[k];
+        const size_t nselected = slot.counts[k+1] - slot.counts[k];
+        // hits kept by the kernel, truth from the host store
+        EventStore selected = UnpackEventHits(events, i, eventOutput, nselected);
+        HoughEvent(selected, 0, config, images[d], found);
+        if (i < m_nprint) { // the roads just found, still of event 0 of selected
+          std::lock_guard<std::mutex> lock(printing);
+          print_info_wire_hits(eventOutput, nselected);
+          for (size_t r = firstRoad; r < found.size(); ++r) PrintRoad(selected, found[r], config);
+        }
+        for (size_t r = firstRoad; r < found.size(); ++r) found[r].event = i; // event 0 of the one-event store
+      }
+      nevents[d]++;
+    }
+    t.hough += secondsSince(houghStart);
+  }, roads);
+
+  m_times = StageTimes();
+  m_cuBatches.assign(ncu, 0);
+  m_nevents = 0;
+  m_wireBytes = 0; // PCIe traffic of the run
+  m_blockBytes = 0;
+  for (size_t b = 0; b < batches.size(); b++) m_blockBytes += BlockBatchBytes(batches[b]);
+  for (unsigned cu = 0; cu < ncu; cu++) {
+    for (size_t s = 0; s < depth; s++) {
+      m_times += times[cu * depth + s];
+      m_nevents += nevents[cu * depth + s];
+      m_wireBytes += wireBytes[cu * depth + s];
+    }
+    m_cuBatches[cu] = dispatcher.batchesOn(cu);
+  }
+
+  for (unsigned cu = 0; cu < ncu; cu++) {
+    for (size_t s = 0; s < depth; s++) {
+      queues[cu].enqueueUnmapMemObject(slots[cu][s].in_buff, slots[cu][s].input);
+      queues[cu].enqueueUnmapMemObject(slots[cu][s].counts_buff, slots[cu][s].counts);
+      queues[cu].enqueueUnmapMemObject(slots[cu][s].offsets_buff, slots[cu][s].offsets);
+    }
+    queues[cu].finish();
+  }
+}
+
+void OpenCLBackend::report(double seconds) const {
+
+  // busy time of each stage summed over the CUs and their slots, occupancy against what can run at once
+  // (ncu CUs on the card, ncu x depth threads on the host): the busiest stage limits the throughput
+  const double device = m_ncu * seconds, host = m_ncu * m_depth * seconds;
+  printf(" compute units: %u depth: %zu kernel: %s\n", m_ncu, m_depth, m_houghOnCard ? "tkHough" : "tk");
+  printf(" %-24s %10s %10s\n", "stage", "busy[s]", "occupancy");
+  printf(" %-24s %10.4f %9.1f%%\n", "pack (host)", m_times.pack, 100*m_times.pack/host);
+  const double write = m_profile.busy(COMMAND_WRITE), kernel = m_profile.busy(COMMAND_KERNEL);
+  const double read = m_profile.busy(COMMAND_COUNTS) + m_profile.busy(COMMAND_READ);
+  printf(" %-24s %10.4f %9.1f%%\n", "host -> device", write, 100*write/device);
+  printf(" %-24s %10.4f %9.1f%%\n", "kernel", kernel, 100*kernel/device);
+  printf(" %-24s %10.4f %9.1f%%\n", "device -> host", read, 100*read/device);
+  printf(" %-24s %10.4f %9.1f%%\n", m_houghOnCard ? "roads (CPU threads)" : "Hough (CPU threads)", m_times.hough, 100*m_times.hough/host);
+  printf(" Hough stage waited %.4f s for the device\n", m_times.waitDevice);
+
+  // load balance: the batches each CU took and how busy its kernel was
+  printf(" %-8s %6s %8s %10s %10s\n", "CU", "bank", "batches", "kernel[s]", "occupancy");
+  for (unsigned cu = 0; cu < m_ncu; cu++) {
+    const double busy = m_profile.busy(COMMAND_KERNEL, cu);
+    printf(" %-8u %6u %8zu %10.4f %9.1f%%\n", cu + 1, cu % DDR_BANKS, m_cuBatches[cu], busy, 100*busy/seconds);
+  }
+
+  // PCIe traffic of the run, against the numhits..d0 blocks of doubles the kernel used to take
+  printf(" bytes per event: %.1f (blocks of doubles: %.1f, %.2fx less)\n",
+         (double) m_wireBytes/std::max<size_t>(1, m_nevents), (double) m_blockBytes/std::max<size_t>(1, m_nevents), (double) m_blockBytes/std::max<size_t>(1, m_wireBytes));
+
+  m_profile.print(seconds, m_ncu);
+}
+
+std::vector<cl::Device> get_xilinx_devices()
+{
+    size_t i;
+    cl_int err;
+    std::vector<cl::Platform> platforms;
+    err = cl::Platform::get(&platforms);
+    cl::Platform platform;
+    for (i = 0; i < platforms.size(); i++)
+    {
+        platform = platforms[i];
+        std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(&err);
+        if (platformName == "Xilinx")
+        {
+            std::cout << "INFO: Found Xilinx Platform" << std::endl;
+            break;
+        }
+    }
+    if (i == platforms.size())
+    {
+        std::cout << "ERROR: Failed to find Xilinx platform" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Getting ACCELERATOR Devices and selecting 1st such device
+    std::vector<cl::Device> devices;
+    err = platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices);
+    return devices;
+}
+
+char *read_binary_file(const std::string &xclbin_file_name, unsigned &nb)
+{
+    if (access(xclbin_file_name.c_str(), R_OK) != 0)
+    {
+        printf("ERROR: %s xclbin not available please build\n", xclbin_file_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+    // Loading XCL Bin into char buffer
+    std::cout << "INFO: Loading '" << xclbin_file_name << "'\n";
+    std::ifstream bin_file(xclbin_file_name.c_str(), std::ifstream::binary);
+    bin_file.seekg(0, bin_file.end);
+    nb = bin_file.tellg();
+    bin_file.seekg(0, bin_file.beg);
+    char *buf = new char[nb];
+    bin_file.read(buf, nb);
+    return buf;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include "Backend.h"
+#include "Dispatcher.h"
+#include "DeviceProfile.h"
+#include "WireFormat.h"
+using namespace std;
+
+#define CL_HPP_CL_1_2_DEFAULT_BUILD
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#define CL_HPP_ENABLE_PROGRAM_CONSTRUCTION_FROM_ARRAY_COMPATIBILITY 1
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#include <CL/cl2.hpp>
+#include <CL/cl_ext_xilinx.h>
+
+#ifndef OpenCLBackend_h
+#define OpenCLBackend_h
+
+#define DDR_BANKS 4 // DDR[0..3] of the U250, memory topology indices 0..3
+
+// ================================================
+// ================================================
+// The U250 backend of host_openCL (needs XRT, so only sw_emu/compile_host.sh builds it).
+// ncu compute units tk1..tkN (kernel/u250.cfg), CU c with its buffers in DDR bank c % DDR_BANKS and its own
+// queue. The BatchDispatcher drives each CU with `depth` threads, one per set of buffers: while one packs
+// its batch and enqueues the transfer, kernel and count-table read, another waits for the device and a
+// third runs the Hough stage of the batch whose output is back; the first CU free takes the next batch.
+// kernel "select": tk keeps the hits that form a doublet and the Hough runs on the host;
+// kernel "hough": tkHough returns the roads, the host only runs the events the card leaves to it.
+
+// One set of device buffers of the pipeline, the batch it holds and the events of its commands
+struct PipelineSlot {
+  cl::Kernel kernel; // arguments are per slot
+  cl::Buffer in_buff, out_buff, offsets_buff, counts_buff;
+  WireHit *input;
+  std::vector<WireHit> output; // the kept hits, only the used prefix of out_buff is read back
+  std::vector<WireRoad> found; // the same for the roads of tkHough
+  uint32_t *offsets, *counts;
+  size_t batch;
+  cl::Event written, computed, counted, read;
+};
+
+// busy time of the host stages [s], the device ones are in the DeviceProfile
+struct StageTimes {
+  double pack, hough;
+  double waitDevice; // Hough stage waiting for the device
+  StageTimes() : pack(0), hough(0), waitDevice(0) {}
+  StageTimes& operator+=(const StageTimes& other);
+};
+
+class OpenCLBackend : public HoughBackend {
+  public:
+    // binaryFile empty: tk.xclbin or tkHough.xclbin; the roads of the first nprint events are printed
+    OpenCLBackend(const std::string& kernelName, const std::string& binaryFile, const HoughConfig& config, unsigned ncu, size_t depth, size_t nprint);
+    std::string name() const { return "opencl"; }
+    void run(const EventStore& store, const std::vector<EventBatch>& batches, std::vector<Road>& roads);
+    void report(double seconds) const;
+    // timestamps of every device command of the last run
+    const DeviceProfile& profile() const { return m_profile; }
+
+  private:
+    bool m_houghOnCard;
+    HoughConfig m_config;
+    unsigned m_ncu;
+    size_t m_depth, m_nprint;
+    cl::Device m_device;
+    cl::Context m_context;
+    cl::Program m_program;
+
+    // last run
+    StageTimes m_times; // summed over the CUs
+    std::vector<size_t> m_cuBatches;
+    DeviceProfile m_profile;
+    size_t m_nevents, m_wireBytes, m_blockBytes;
+};
+
+std::vector<cl::Device> get_xilinx_devices();
+char *read_binary_file(const std::string &xclbin_file_name, unsigned &nb);
+
+#endif
@@ -0,0 +1,44 @@
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include "SampleGenerator.h"
+#ifndef SampleGenerator_cxx
+#define SampleGenerator_cxx
+
+using namespace std;
+
+EventStore MakeSyntheticSample(const EventStore& seed, size_t nevents, unsigned pileup, unsigned randomSeed) {
+
+  std::vector<size_t> nonEmpty;
+  for (size_t e = 0; e < seed.nEvents(); ++e) if (seed.nHits(e) > 0) nonEmpty.push_back(e);
+  if (nonEmpty.empty()) throw std::runtime_error("MakeSyntheticSample: seed sample has no hits");
+  if (pileup == 0) pileup = 1;
+
+  std::mt19937 rng(randomSeed);
+  std::uniform_int_distribution<size_t> pick(0, nonEmpty.size()-1);
+  std::uniform_real_distribution<double> angle(-M_PI, M_PI);
+
+  EventColumns cols;
+  cols.offsets.push_back(0);
+  for (size_t event = 0; event < nevents; ++event) {
+    for (unsigned k = 0; k < pileup; ++k) {
+      const size_t from = nonEmpty[pick(rng)];
+      const double phi = angle(rng);
+      const double c = std::cos(phi), s = std::sin(phi);
+      if (k == 0) {
+        cols.charge.push_back(seed.charge(from)); cols.pt.push_back(seed.pt(from)); cols.d0.push_back(seed.d0(from));
+      }
+      for (size_t j = seed.begin(from); j < seed.end(from); ++j) {
+        cols.layer.push_back(seed.layer()[j]);
+        cols.r.push_back(seed.r()[j]);
+        cols.x.push_back(c*seed.x()[j] - s*seed.y()[j]);
+        cols.y.push_back(s*seed.x()[j] + c*seed.y()[j]);
+        cols.z.push_back(seed.z()[j]);
+      }
+    }
+    cols.offsets.push_back(cols.layer.size());
+  }
+  return EventStore(std::move(cols));
+}
+
+#endif
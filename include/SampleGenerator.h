@@ -0,0 +1,14 @@
+#include "EventStore.h"
+using namespace std;
+
+#ifndef SampleGenerator_h
+#define SampleGenerator_h
+
+// ================================================
+// ================================================
+// Synthetic samples for the benchmarks, built from a seed store (e.g. the single muons).
+// Every generated event overlays `pileup` randomly chosen non-empty seed events, each rotated
+// by a random phi so that the tracks do not line up; the truth is the one of the first overlay.
+EventStore MakeSyntheticSample(const EventStore& seed, size_t nevents, unsigned pileup, unsigned randomSeed);
+
+#endif
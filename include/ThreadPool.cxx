@@ -0,0 +1,95 @@
+#include "ThreadPool.h"
+#ifndef ThreadPool_cxx
+#define ThreadPool_cxx
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned nthreads) :
+  m_queues(nthreads ? nthreads : 1), m_task(NULL), m_generation(0), m_busy(0), m_stop(false), m_pending(0)
+{
+  for (unsigned w = 0; w < m_queues.size(); ++w) m_threads.push_back(std::thread(&ThreadPool::run, this, w));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (size_t w = 0; w < m_threads.size(); ++w) m_threads[w].join();
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t, unsigned)>& task) {
+  if (n == 0) return;
+
+  const size_t nworkers = m_queues.size();
+  for (size_t w = 0; w < nworkers; ++w) {
+    std::lock_guard<std::mutex> lock(m_queues[w].mutex);
+    for (size_t i = n*w/nworkers; i < n*(w+1)/nworkers; ++i) m_queues[w].items.push_back(i);
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_task = &task;
+  m_error = std::exception_ptr();
+  m_pending = n;
+  m_busy = nworkers;
+  ++m_generation;
+  m_wake.notify_all();
+  // wait for the last task and for every worker to have left the job,
+  // so that nobody still holds a pointer to this task afterwards
+  m_done.wait(lock, [this]{ return m_pending == 0 && m_busy == 0; });
+  m_task = NULL;
+  if (m_error) std::rethrow_exception(m_error);
+}
+
+bool ThreadPool::take(unsigned worker, size_t& item) {
+  {
+    WorkQueue& own = m_queues[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.items.empty()) {
+      item = own.items.front();
+      own.items.pop_front();
+      return true;
+    }
+  }
+  for (size_t k = 1; k < m_queues.size(); ++k) {
+    WorkQueue& victim = m_queues[(worker + k) % m_queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.items.empty()) {
+      item = victim.items.back();
+      victim.items.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run(unsigned worker) {
+  size_t seen = 0;
+  while (true) {
+    const std::function<void(size_t, unsigned)>* task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [&]{ return m_stop || m_generation != seen; });
+      if (m_stop) return;
+      seen = m_generation;
+      task = m_task;
+    }
+
+    size_t item;
+    while (take(worker, item)) {
+      try {
+        (*task)(item, worker);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_error) m_error = std::current_exception();
+      }
+      --m_pending;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_busy == 0) m_done.notify_all();
+  }
+}
+
+#endif
@@ -0,0 +1,54 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+// ================================================
+// ================================================
+// Work-stealing thread pool.
+// parallelFor deals the task indices out in contiguous blocks to one deque per worker;
+// a worker takes from the front of its own deque and, once it is empty, steals from the
+// back of the others. The worker id passed to the task lets callers keep per-worker state.
+class ThreadPool {
+  public:
+    explicit ThreadPool(unsigned nthreads);
+    ~ThreadPool();
+
+    unsigned size() const { return m_threads.size(); }
+    // runs task(i, worker) for every i in [0, n) and returns when all of them are done
+    void parallelFor(size_t n, const std::function<void(size_t, unsigned)>& task);
+
+  private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    struct WorkQueue {
+      std::mutex mutex;
+      std::deque<size_t> items;
+    };
+
+    void run(unsigned worker);
+    bool take(unsigned worker, size_t& item);
+
+    std::vector<std::thread> m_threads;
+    std::vector<WorkQueue> m_queues;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_done;
+    const std::function<void(size_t, unsigned)>* m_task;
+    size_t m_generation;
+    unsigned m_busy;
+    bool m_stop;
+    std::atomic<size_t> m_pending;
+    std::exception_ptr m_error;
+};
+
+#endif
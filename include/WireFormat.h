@@ -0,0 +1,38 @@
+#include <stdint.h>
+
+#ifndef WireFormat_h
+#define WireFormat_h
+
+// ================================================
+// ================================================
+// Host <-> tk kernel transfer format, shared by host/ and kernel/ (plain C++, no std headers).
+//
+// A batch is a WireHit array with the hits of its events back to back and a uint32_t offset table,
+// event e owning the hits [offsets[e], offsets[e+1]): the offsets are the per-event header.
+// The hits keep the precision of the event store (float32 coordinates, layer as int16), so 20 bytes
+// go over PCIe per hit instead of the 72 of a numhits/layer/r/x/y/z/charge/pt/d0 block of doubles;
+// the hit counts and the truth (charge, pt, d0) never leave the host.
+#define WIREHIT_KEPT 1 // flags bit set by the kernel on the hits it selects
+
+struct WireHit {
+  float r, x, y, z;
+  int16_t layer;
+  uint16_t flags;
+};
+
+// Road found on the card by the tkHough kernel (kernel/hough_kernel.cxx), packed per event like the kept
+// hits of tk: event e of the batch owns the roads [counts[e], counts[e+1]), at most WIREROAD_MAX_PER_EVENT.
+// An event the kernel cannot hold (too many hits or roads) gets a single road flagged WIREROAD_OVERFLOW
+// and is left to the host.
+#define WIREROAD_MAX_PER_EVENT 4096
+#define WIREROAD_OVERFLOW 1
+
+struct WireRoad {
+  uint32_t event; // in the batch
+  int16_t x;      // d0 bin
+  int16_t y;      // q/pT bin
+  uint16_t count; // doublets in the bin
+  uint16_t flags;
+};
+
+#endif
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <limits>
+#include <algorithm>
 using namespace std;
 
 #ifndef PlotHelper_h
@@ -60,6 +61,11 @@ class vector2D
         m_data.resize(x1*x2, t);
     }
 
+    void fill(T const & t=T())
+    {
+        std::fill(m_data.begin(), m_data.end(), t);
+    }
+
     T & operator()(size_t i, size_t j)
     {
 #ifdef DEBUG_HTTVECTORS
@@ -0,0 +1,60 @@
+#ifndef hls_stream_shim_h
+#define hls_stream_shim_h
+
+// ================================================
+// ================================================
+// hls::stream for the kernels: the Vitis one when its headers are there (v++, Vitis HLS C simulation),
+// otherwise a header-only stand-in so that the dataflow kernels build and run under plain g++.
+// Without Vitis the functions of a DATAFLOW region simply run one after the other, each one
+// producing its whole output before the next starts, so the FIFO only has to grow: an unbounded
+// deque, as in the Vitis C simulation. Reading an empty stream is a deadlock in hardware and
+// throws here.
+#if __has_include(<hls_stream.h>)
+#include <hls_stream.h>
+#else
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+namespace hls {
+
+template <typename T>
+class stream {
+  public:
+    stream() : m_name("stream") {}
+    explicit stream(const char* name) : m_name(name) {}
+
+    void write(const T& value) { m_fifo.push_back(value); }
+    T read() {
+      if (m_fifo.empty()) throw std::runtime_error("hls::stream " + m_name + ": read from an empty stream");
+      T value = m_fifo.front();
+      m_fifo.pop_front();
+      return value;
+    }
+    void read(T& value) { value = read(); }
+    bool read_nb(T& value) {
+      if (m_fifo.empty()) return false;
+      value = read();
+      return true;
+    }
+    bool write_nb(const T& value) { write(value); return true; }
+
+    stream& operator<<(const T& value) { write(value); return *this; }
+    stream& operator>>(T& value) { value = read(); return *this; }
+
+    bool empty() const { return m_fifo.empty(); }
+    bool full() const { return false; }
+    size_t size() const { return m_fifo.size(); }
+
+  private:
+    stream(const stream&);            // a FIFO is not copied, as in Vitis
+    stream& operator=(const stream&);
+
+    std::deque<T> m_fifo;
+    std::string m_name;
+};
+
+} // namespace hls
+#endif
+
+#endif
@@ -0,0 +1,219 @@
+#include "math.h"
+#include "hough_kernel.h"
+
+// Doublet Hough transform on the card: for each event of the batch the hits are copied on chip, every
+// pair passing the layer, radius and r-z cuts fills its line in a 216x216 accumulator held in URAM, and
+// threshold + 3x3 local maxima turn the accumulator into roads; only the roads go back to the host.
+//
+// The parameters are the HoughConfig defaults with the same types, and every step does the operations
+// of the host code (GetR, GetDoubletTerms, DoubletBinsRows, the continuous fill and FindPeaks) in the
+// same order, so the C simulation finds the roads of HoughEvent bit for bit.
+#define HOUGH_X 216 // d0 bins
+#define HOUGH_Y 216 // q/pT bins
+#define HOUGH_THRESHOLD 8   // min doublets in a bin with |d0| >= 50
+#define HOUGH_THRESHOLD50 8 // min doublets in a bin with |d0| < 50
+#define HOUGH_COUNT_MAX 65535
+
+typedef unsigned short hough_count_t;
+
+static const double m_acceptedDistanceBetweenLayersMin = 200; // min R disstance for hits pair filtering
+static const double m_acceptedDistanceBetweenLayersMax = 600;
+static const float m_d0_range = 120;
+static const float m_qOverPt_range = 0.002;
+
+// constants of the q/pT rows, as HoughRowTable
+static void rowTable(double rowR2[HOUGH_Y], double rowAbsR[HOUGH_Y], double rowSign[HOUGH_Y]){
+  const double m_step_y = (2*m_qOverPt_range) / HOUGH_Y; // float arithmetic, as HoughConfig::stepY
+  for (int y=0; y<HOUGH_Y; y++) {
+    const double qoverpt = -1.*( (y * m_step_y) + m_step_y*0.5 - m_qOverPt_range);
+    const double radius = 1.0/(0.6*qoverpt);
+    rowR2[y] = radius*radius;
+    rowAbsR[y] = fabs(radius);
+    rowSign[y] = signbit(radius) ? -1.0 : 1.0;
+  }
+}
+
+// hits of one event copied on chip, with the radius of GetR and, for the eta window, the eta of GetEta
+static void loadHits(const WireHit *input, unsigned int n, bool withEta, float hx[HOUGH_MAX_HITS], float hy[HOUGH_MAX_HITS], float hz[HOUGH_MAX_HITS],
+                     double hr[HOUGH_MAX_HITS], double heta[HOUGH_MAX_HITS], short hlayer[HOUGH_MAX_HITS]){
+  for (unsigned int i=0; i<n; i++) {
+#pragma HLS PIPELINE II=1
+    const WireHit hit = input[i];
+    hx[i] = hit.x;
+    hy[i] = hit.y;
+    hz[i] = hit.z;
+    hr[i] = sqrt((double) hit.x*hit.x + (double) hit.y*hit.y);
+    heta[i] = 0;
+    if (withEta) {
+      const double r3 = sqrt(hr[i]*hr[i] + (double) hit.z*hit.z);
+      heta[i] = -log(tan(acos(hit.z/r3)*0.5));
+    }
+    hlayer[i] = hit.layer;
+  }
+}
+
+// r-z windows of MakeDoublets between the inner hit 1 and the outer hit 2, a window <= 0 is not applied
+static bool isCompatibleRZ(double r1, double z1, double eta1, double r2, double z2, double eta2, float z0Window, float detaWindow){
+  if (z0Window > 0 && !(fabs(z1 - r1*(z2 - z1)/(r2 - r1)) < z0Window)) return false; // cut on z0
+  if (detaWindow > 0 && !(fabs(eta1 - eta2) < detaWindow)) return false; // cut on difference in eta
+  return true;
+}
+
+// line of the doublet (x1, y1) (x2, y2) in the accumulator, the bins between the d0 of two
+// consecutive rows included (m_continuous)
+static void fillDoublet(double x1, double y1, double x2, double y2, const double rowR2[HOUGH_Y], const double rowAbsR[HOUGH_Y],
+                        const double rowSign[HOUGH_Y], hough_count_t image[HOUGH_X][HOUGH_Y]){
+  const double m_step_x = (2*m_d0_range) / HOUGH_X;
+
+  // DoubletTerms of the chord
+  const double halfx = (x2 - x1)*0.5, halfy = (y2 - y1)*0.5;
+  const double midx = x1 + halfx, midy = y1 + halfy;
+  const double h2 = halfx*halfx + halfy*halfy;
+  const double A = midx*midx + midy*midy - h2;
+  const double B = 2*(midy*halfx - midx*halfy) / sqrt(h2);
+
+  int xbefore = -1;
+  for (int y=1; y<HOUGH_Y; y++) {
+    const double R2 = rowR2[y];
+    if ( !(R2 > h2) ) continue; // no circle of this radius through both hits
+    const double t = rowSign[y]*B*sqrt(R2 - h2);
+    const double d0 = rowSign[y]*(A + t)/(sqrt(A + R2 + t) + rowAbsR[y]);
+    const double xd = (d0 + m_d0_range) / m_step_x;
+    if ( !(1 <= xd && xd < HOUGH_X) ) continue; // outside the image
+    const int x = (int) xd;
+    if (xbefore == -1) xbefore = x;
+    const int xmin = (xbefore < x) ? xbefore : x, xmax = (xbefore < x) ? x : xbefore;
+    // one read-modify-write per cycle, the bins of a segment are all different
+    for (int xi=xmin; xi<=xmax; xi++) {
+#pragma HLS PIPELINE II=1
+#pragma HLS DEPENDENCE variable = image inter false
+      if (image[xi][y] != HOUGH_COUNT_MAX) image[xi][y]++;
+    }
+    xbefore = x;
+  }
+}
+
+// max over y-1, y, y+1 of one d0 column
+static void columnMax3(const hough_count_t column[HOUGH_Y], hough_count_t out[HOUGH_Y]){
+  for (int y=0; y<HOUGH_Y; y++) {
+#pragma HLS PIPELINE II=1
+    hough_count_t m = column[y];
+    if (y > 0 && column[y-1] > m) m = column[y-1];
+    if (y+1 < HOUGH_Y && column[y+1] > m) m = column[y+1];
+    out[y] = m;
+  }
+}
+
+// Threshold + 3x3 maximum as FindPeaks, streaming the d0 columns with a ring of three column maxima.
+// Each column is cleared once its bins are read, so the accumulator is zero again for the next event.
+// The roads are ordered by q/pT row then d0 bin; returns their number, -1 if there are more than fit.
+static int findRoads(hough_count_t image[HOUGH_X][HOUGH_Y], unsigned int event, WireRoad found[WIREROAD_MAX_PER_EVENT]){
+  const double m_step_x = (2*m_d0_range) / HOUGH_X;
+  hough_count_t colMax[3][HOUGH_Y];
+  WireRoad peaks[WIREROAD_MAX_PER_EVENT]; // column order
+  int npeaks = 0;
+  bool overflow = false;
+
+  columnMax3(image[0], colMax[0]);
+  for (int x=0; x<HOUGH_X; x++) {
+    if (x+1 < HOUGH_X) columnMax3(image[x+1], colMax[(x+1)%3]);
+    const int centre = x%3;
+    const int left = (x > 0) ? (x-1)%3 : centre, right = (x+1 < HOUGH_X) ? (x+1)%3 : centre;
+    const float d0 = x*m_step_x - m_d0_range; // xtod0
+    const int threshold = fabs(d0) < 50.0 ? HOUGH_THRESHOLD50 : HOUGH_THRESHOLD;
+
+    for (int y=0; y<HOUGH_Y; y++) {
+#pragma HLS PIPELINE II=1
+      const hough_count_t count = image[x][y];
+      hough_count_t around = colMax[left][y];
+      if (colMax[centre][y] > around) around = colMax[centre][y];
+      if (colMax[right][y] > around) around = colMax[right][y];
+      if (count >= threshold && count >= around) {
+        if (npeaks < WIREROAD_MAX_PER_EVENT) {
+          peaks[npeaks].event = event;
+          peaks[npeaks].x = x;
+          peaks[npeaks].y = y;
+          peaks[npeaks].count = count;
+          peaks[npeaks].flags = 0;
+          npeaks++;
+        } else {
+          overflow = true;
+        }
+      }
+      image[x][y] = 0;
+    }
+  }
+  if (overflow) return -1;
+
+  // counting sort by q/pT row, stable, so d0 bins stay increasing within a row
+  unsigned int rowStart[HOUGH_Y+1];
+  for (int y=0; y<=HOUGH_Y; y++) rowStart[y] = 0;
+  for (int k=0; k<npeaks; k++) rowStart[peaks[k].y + 1]++;
+  for (int y=0; y<HOUGH_Y; y++) rowStart[y+1] += rowStart[y];
+  for (int k=0; k<npeaks; k++) found[rowStart[peaks[k].y]++] = peaks[k];
+  return npeaks;
+}
+
+extern "C"
+{
+  void tkHough(WireHit *input, WireRoad *roads, unsigned int *offsets, unsigned int *counts, unsigned int nevents,
+               float z0Window, float detaWindow){
+#pragma HLS INTERFACE m_axi port = input bundle = gmem0
+#pragma HLS INTERFACE m_axi port = offsets bundle = gmem0
+#pragma HLS INTERFACE m_axi port = roads bundle = gmem1
+#pragma HLS INTERFACE m_axi port = counts bundle = gmem1
+
+    // zero at start-up and after every event (findRoads clears it), 93 kB: URAM. Each CU has its own;
+    // in the C simulation each thread standing in for a CU (./benchmark dispatch) has its own.
+#ifdef __SYNTHESIS__
+    static hough_count_t image[HOUGH_X][HOUGH_Y];
+#else
+    static thread_local hough_count_t image[HOUGH_X][HOUGH_Y];
+#endif
+#pragma HLS BIND_STORAGE variable = image type = ram_t2p impl = uram
+
+    double rowR2[HOUGH_Y], rowAbsR[HOUGH_Y], rowSign[HOUGH_Y];
+    rowTable(rowR2, rowAbsR, rowSign);
+
+    float hx[HOUGH_MAX_HITS], hy[HOUGH_MAX_HITS], hz[HOUGH_MAX_HITS];
+    double hr[HOUGH_MAX_HITS], heta[HOUGH_MAX_HITS];
+    short hlayer[HOUGH_MAX_HITS];
+    WireRoad found[WIREROAD_MAX_PER_EVENT];
+
+    unsigned int nroads = 0;
+    counts[0] = 0;
+    for (unsigned int e=0; e<nevents; e++) { // loop over the events of the batch
+      const unsigned int first = offsets[e], n = offsets[e+1] - first;
+      int nfound = -1;
+      if (n <= HOUGH_MAX_HITS) {
+        loadHits(input + first, n, detaWindow > 0, hx, hy, hz, hr, heta, hlayer);
+        for (unsigned int i=0; i<n; i++) { // loop over features
+          for (unsigned int j=i+1; j<n; j++) { // loop over features
+            const double radiusDifference = hr[j] - hr[i];
+            if (hlayer[i] == hlayer[j]) continue; // cut on layer
+            if ( not (m_acceptedDistanceBetweenLayersMin < radiusDifference && radiusDifference < m_acceptedDistanceBetweenLayersMax) ) continue; // cut on difference in r
+            if (!isCompatibleRZ(hr[i], hz[i], heta[i], hr[j], hz[j], heta[j], z0Window, detaWindow)) continue; // r-z pre-filter
+            fillDoublet(hx[i], hy[i], hx[j], hy[j], rowR2, rowAbsR, rowSign, image);
+          }
+        }
+        nfound = findRoads(image, e, found);
+      }
+
+      if (nfound < 0) { // left to the host
+        roads[nroads].event = e;
+        roads[nroads].x = -1;
+        roads[nroads].y = -1;
+        roads[nroads].count = 0;
+        roads[nroads].flags = WIREROAD_OVERFLOW;
+        nroads++;
+      } else {
+        for (int k=0; k<nfound; k++) {
+#pragma HLS PIPELINE II=1
+          roads[nroads + k] = found[k];
+        }
+        nroads += nfound;
+      }
+      counts[e+1] = nroads;
+    }
+  }
+}
@@ -0,0 +1,20 @@
+#include "../include/WireFormat.h"
+
+#ifndef hough_kernel_h
+#define hough_kernel_h
+
+// ================================================
+// ================================================
+// tkHough: the whole doublet Hough transform of a batch of events on the card, hits in and roads out.
+// Plain C++ with HLS pragmas: v++ builds it for the U250 and g++ builds it as the C-simulation
+// reference that ./benchmark kernel checks against HoughEvent.
+//
+// Same arguments as tk, the output buffer holding WireRoads: event e owns the hits
+// [offsets[e], offsets[e+1]) of input and the roads [counts[e], counts[e+1]) of roads, and the doublets
+// pass the same r-z windows as in MakeDoublets.
+#define HOUGH_MAX_HITS 1024 // hits of one event held on chip, larger events come back as WIREROAD_OVERFLOW
+
+extern "C" void tkHough(WireHit *input, WireRoad *roads, unsigned int *offsets, unsigned int *counts, unsigned int nevents,
+                        float z0Window, float detaWindow);
+
+#endif
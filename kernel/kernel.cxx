@@ -1,52 +1,234 @@
 #include "math.h"
+#include "hls_stream_shim.h"
+#include "kernel.h"
 
-// A testing kernel, does nothing but return the input
+// A testing kernel, keeps the hits that form at least one doublet with an earlier hit.
+// One invocation handles a batch of events, event e owns the hits [offsets[e], offsets[e+1])
+// (WireHit layout, include/WireFormat.h). The kept hits are packed densely at the start of output,
+// in event order, and event e owns the kept hits [counts[e], counts[e+1]): counts[nevents] is the
+// number of hits the host has to read back.
+//
+// Dataflow: readHits -> selectHits -> writeHits run concurrently, connected by FIFOs. Global memory is
+// only read and written sequentially, so the accesses become AXI bursts, and input/offsets and
+// output/counts are on separate bundles (and DDR banks, kernel/u250.cfg).
+//
+// z0Window and detaWindow are the r-z pre-filter of HoughConfig (m_z0Window, m_detaWindow): with a window > 0
+// a pair is only a doublet if the line through the two hits in r-z crosses r = 0 within |z| < z0Window and
+// their eta differ by less than detaWindow, so at pileup fewer hits reach the Hough on the host.
+//
+// selectHits holds BLOCK_HITS hits on chip, bucketed by layer and sorted by r, so that each hit only
+// looks at the hits of the other layers inside its r windows. A larger event goes through in blocks:
+// the reader streams each block and then every hit of the event before it, and those earlier hits
+// mark the block hits they pair with.
+#define BLOCK_HITS 1024
+#define MAX_LAYERS 16
 
-extern "C"
-{
-  void tk(double *input, double *output, unsigned int size){
-    // void tk(double *input, double *output){
-#pragma HLS INTERFACE m_axi port = input bundle = gmem1
-#pragma HLS INTERFACE m_axi port = output bundle = gmem1
-    // return input
-
-    // KERNEL
-    const double m_acceptedDistanceBetweenLayersMin = 200; // min R disstance for hits pair filtering
-    const double m_acceptedDistanceBetweenLayersMax = 600;
-
-    int size_features = size/9;
-    for (unsigned int i=0; i<size_features; i++) { // loop over features
-      if(i==0){
-        output[9*i]   = input[9*i];    // numhits
-        output[9*i+1] = input[9*i+1];  // layer
-        output[9*i+2] = input[9*i+2];  // r
-        output[9*i+3] = input[9*i+3];  // x
-        output[9*i+4] = input[9*i+4];  // y
-        output[9*i+5] = input[9*i+5];  // z
-        output[9*i+6] = input[9*i+6];  // charge
-        output[9*i+7] = input[9*i+7];  // pt
-        output[9*i+8] = input[9*i+8];  // d0
+// header of a block in the hit stream
+struct BlockInfo {
+  unsigned int nblock;   // hits of the block, streamed first
+  unsigned int nearlier; // hits of the event before the block, streamed after them
+  bool first;            // first block of the event, whose first hit is always kept
+  bool last;             // last block of the event
+};
+
+// header of the kept hits of a block in the output stream
+struct KeptInfo {
+  unsigned int nkept;
+  bool last; // last block of the event
+};
+
+static const double m_acceptedDistanceBetweenLayersMin = 200; // min R disstance for hits pair filtering
+static const double m_acceptedDistanceBetweenLayersMax = 600;
+
+// burst read of the batch, block by block
+static void readHits(const WireHit *input, const unsigned int *offsets, unsigned int nevents,
+                     hls::stream<BlockInfo>& blocks, hls::stream<WireHit>& hits){
+  for (unsigned int e=0; e<nevents; e++) { // loop over the events of the batch
+    const unsigned int first = offsets[e], n = offsets[e+1] - first;
+    unsigned int start = 0;
+    do {
+      BlockInfo block;
+      block.nblock = (n - start < BLOCK_HITS) ? n - start : BLOCK_HITS;
+      block.nearlier = start;
+      block.first = (start == 0);
+      block.last = (start + block.nblock == n);
+      blocks.write(block);
+      for (unsigned int k=0; k<block.nblock; k++) {
+#pragma HLS PIPELINE II=1
+        hits.write(input[first + start + k]);
+      }
+      for (unsigned int k=0; k<start; k++) {
+#pragma HLS PIPELINE II=1
+        hits.write(input[first + k]);
+      }
+      start += block.nblock;
+    } while (start < n);
+  }
+}
+
+// first position of a bucket with r >= rmin
+static unsigned int lowerBound(const double bucketR[BLOCK_HITS], unsigned int size, double rmin){
+  unsigned int lo = 0, hi = size;
+  while (lo < hi) {
+    const unsigned int mid = (lo + hi)/2;
+    if (bucketR[mid] < rmin) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// eta of a hit, as GetEta
+static double hitEta(const WireHit& hit){
+  const double r = sqrt((double) hit.x*hit.x + (double) hit.y*hit.y);
+  const double r3 = sqrt(r*r + (double) hit.z*hit.z);
+  const double theta = acos(hit.z/r3);
+  return -log(tan(theta*0.5));
+}
+
+// r-z windows between hits i and j with their eta, a window <= 0 is not applied: z0 extrapolated from the
+// inner hit (z1 - r1*dz/dr), and the eta difference
+static bool isCompatibleRZ(double ri, double zi, double etai, double rj, double zj, double etaj, float z0Window, float detaWindow){
+  const double r1 = ri < rj ? ri : rj, z1 = ri < rj ? zi : zj;
+  const double r2 = ri < rj ? rj : ri, z2 = ri < rj ? zj : zi;
+  if (z0Window > 0 && !(fabs(z1 - r1*(z2 - z1)/(r2 - r1)) < z0Window)) return false; // cut on z0
+  if (detaWindow > 0 && !(fabs(etai - etaj) < detaWindow)) return false; // cut on difference in eta
+  return true;
+}
+
+// pair cut between hits i and j
+static bool isDoublet(double ri, int layeri, double rj, int layerj){
+  double radiusDifference = abs(rj - ri);
+  if (layeri==layerj) return false; // cut on layer
+  return m_acceptedDistanceBetweenLayersMin < radiusDifference && radiusDifference < m_acceptedDistanceBetweenLayersMax; // cut on difference in r
+}
+
+// hit selection, block by block
+static void selectHits(unsigned int nevents, float z0Window, float detaWindow, hls::stream<BlockInfo>& blocks, hls::stream<WireHit>& hits,
+                       hls::stream<KeptInfo>& keptBlocks, hls::stream<WireHit>& kept){
+
+  // bucket b holds the block hits with layer % MAX_LAYERS == b, sorted by r (insertion sort, a few hits per layer);
+  // layers sharing a bucket are told apart by the layer cut
+  WireHit blockHits[BLOCK_HITS];
+  double blockEta[BLOCK_HITS];
+  bool keep[BLOCK_HITS];
+  double bucketR[MAX_LAYERS][BLOCK_HITS];
+  unsigned int bucketHit[MAX_LAYERS][BLOCK_HITS];
+  unsigned int bucketSize[MAX_LAYERS];
+
+  for (unsigned int e=0; e<nevents; e++) { // loop over the events of the batch
+    BlockInfo block;
+    do {
+      block = blocks.read();
+      for (int b=0; b<MAX_LAYERS; b++) bucketSize[b] = 0;
+
+      for (unsigned int i=0; i<block.nblock; i++) {
+        const WireHit hit = hits.read();
+        blockHits[i] = hit;
+        blockEta[i] = (detaWindow > 0) ? hitEta(hit) : 0;
+        keep[i] = (block.first && i==0);
+        const int b = ((hit.layer % MAX_LAYERS) + MAX_LAYERS) % MAX_LAYERS;
+        const double r = hit.r;
+        unsigned int pos = bucketSize[b];
+        while (pos > 0 && bucketR[b][pos-1] > r) {
+          bucketR[b][pos] = bucketR[b][pos-1];
+          bucketHit[b][pos] = bucketHit[b][pos-1];
+          pos--;
+        }
+        bucketR[b][pos] = r;
+        bucketHit[b][pos] = i;
+        bucketSize[b]++;
+      }
+
+      // hits of the event before the block: every block hit in their r windows is a partner
+      for (unsigned int k=0; k<block.nearlier; k++) {
+        const WireHit hit = hits.read();
+        const double ri = hit.r;
+        const double etai = (detaWindow > 0) ? hitEta(hit) : 0;
+        const double slack = 1e-9*(fabs(ri) + m_acceptedDistanceBetweenLayersMax); // rounding margin of the window, the cut is exact
+        for (int b=0; b<MAX_LAYERS; b++) {
+          for (unsigned int p=lowerBound(bucketR[b], bucketSize[b], ri - m_acceptedDistanceBetweenLayersMax - slack);
+               p<bucketSize[b] && bucketR[b][p] <= ri + m_acceptedDistanceBetweenLayersMax + slack; p++) {
+            const unsigned int j = bucketHit[b][p];
+            if (isDoublet(ri, hit.layer, bucketR[b][p], blockHits[j].layer) &&
+                isCompatibleRZ(ri, hit.z, etai, bucketR[b][p], blockHits[j].z, blockEta[j], z0Window, detaWindow)) keep[j] = true;
+          }
+        }
       }
-      for (unsigned int j=i+1; j<size_features; j++) { // loop over features
-        // if (i==j) continue;
 
-        double radiusDifference = abs(input[9*j+2] - input[9*i+2]);
-        if (input[9*i+1]==input[9*j+1]) continue; // cut on layer
-        if (  not (m_acceptedDistanceBetweenLayersMin < radiusDifference && radiusDifference < m_acceptedDistanceBetweenLayersMax) ){ // cut on difference in r
-          continue;
+      // pairs inside the block: an earlier block hit i on another layer with 200 < |r_j - r_i| < 600
+      for (unsigned int j=0; j<block.nblock; j++) {
+        const double rj = blockHits[j].r;
+        const double slack = 1e-9*(fabs(rj) + m_acceptedDistanceBetweenLayersMax);
+        for (int b=0; b<MAX_LAYERS && !keep[j]; b++) {
+          for (unsigned int p=lowerBound(bucketR[b], bucketSize[b], rj - m_acceptedDistanceBetweenLayersMax - slack);
+               p<bucketSize[b] && bucketR[b][p] <= rj + m_acceptedDistanceBetweenLayersMax + slack; p++) {
+            const unsigned int i = bucketHit[b][p];
+            if (i >= j) continue;
+            if (isDoublet(bucketR[b][p], blockHits[i].layer, rj, blockHits[j].layer) &&
+                isCompatibleRZ(bucketR[b][p], blockHits[i].z, blockEta[i], rj, blockHits[j].z, blockEta[j], z0Window, detaWindow)) {
+              keep[j] = true;
+              break;
+            }
+          }
         }
+      }
+
+      KeptInfo info;
+      info.nkept = 0;
+      info.last = block.last;
+      for (unsigned int j=0; j<block.nblock; j++) info.nkept += keep[j];
+      keptBlocks.write(info);
+      for (unsigned int j=0; j<block.nblock; j++) {
+#pragma HLS PIPELINE II=1
+        if (!keep[j]) continue;
+        WireHit hit = blockHits[j];
+        hit.flags = WIREHIT_KEPT;
+        kept.write(hit);
+      }
+    } while (!block.last);
+  }
+}
 
-        output[9*j]   = input[9*j];    // numhits
-        output[9*j+1] = input[9*j+1];  // layer
-        output[9*j+2] = input[9*j+2];  // r
-        output[9*j+3] = input[9*j+3];  // x
-        output[9*j+4] = input[9*j+4];  // y
-        output[9*j+5] = input[9*j+5];  // z
-        output[9*j+6] = input[9*j+6];  // charge
-        output[9*j+7] = input[9*j+7];  // pt
-        output[9*j+8] = input[9*j+8];  // d0
-        // out[j] = temp[i];
+// burst write of the kept hits, packed, and of the count table
+static void writeHits(unsigned int nevents, hls::stream<KeptInfo>& keptBlocks, hls::stream<WireHit>& kept,
+                      WireHit *output, unsigned int *counts){
+  unsigned int nkept = 0;
+  counts[0] = 0;
+  for (unsigned int e=0; e<nevents; e++) { // loop over the events of the batch
+    KeptInfo info;
+    do {
+      info = keptBlocks.read();
+      for (unsigned int k=0; k<info.nkept; k++) {
+#pragma HLS PIPELINE II=1
+        output[nkept + k] = kept.read();
       }
-    }
+      nkept += info.nkept;
+    } while (!info.last);
+    counts[e+1] = nkept;
+  }
+}
+
+extern "C"
+{
+  void tk(WireHit *input, WireHit *output, unsigned int *offsets, unsigned int *counts, unsigned int nevents,
+          float z0Window, float detaWindow){
+#pragma HLS INTERFACE m_axi port = input bundle = gmem0
+#pragma HLS INTERFACE m_axi port = offsets bundle = gmem0
+#pragma HLS INTERFACE m_axi port = output bundle = gmem1
+#pragma HLS INTERFACE m_axi port = counts bundle = gmem1
+#pragma HLS DATAFLOW
+
+    hls::stream<BlockInfo> blocks("blocks");
+    hls::stream<WireHit> hits("hits");
+    hls::stream<KeptInfo> keptBlocks("keptBlocks");
+    hls::stream<WireHit> kept("kept");
+#pragma HLS STREAM variable = blocks depth = 4
+#pragma HLS STREAM variable = hits depth = 64
+#pragma HLS STREAM variable = keptBlocks depth = 4
+#pragma HLS STREAM variable = kept depth = 64
+
+    readHits(input, offsets, nevents, blocks, hits);
+    selectHits(nevents, z0Window, detaWindow, blocks, hits, keptBlocks, kept);
+    writeHits(nevents, keptBlocks, kept, output, counts);
   }
 }
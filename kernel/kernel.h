@@ -0,0 +1,18 @@
+#include "../include/WireFormat.h"
+
+#ifndef kernel_h
+#define kernel_h
+
+// ================================================
+// ================================================
+// tk: hit selection of a batch of events (kernel/kernel.cxx), a dataflow kernel that v++ builds for
+// the U250 and g++ builds with the hls::stream shim (kernel/hls_stream_shim.h), which is how
+// ./benchmark select checks it against the all-pairs selection.
+//
+// Event e owns the hits [offsets[e], offsets[e+1]) of input; the kept hits are packed in output,
+// event e owning [counts[e], counts[e+1]). z0Window and detaWindow are the r-z windows of the pair cut
+// (HoughConfig::m_z0Window, m_detaWindow), 0 for none.
+extern "C" void tk(WireHit *input, WireHit *output, unsigned int *offsets, unsigned int *counts, unsigned int nevents,
+                   float z0Window, float detaWindow);
+
+#endif
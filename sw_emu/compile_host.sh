@@ -1,2 +1,2 @@
-g++ --std=c++1y -I../include -I$XILINX_XRT/include -L$XILINX_XRT/lib -lOpenCL -lrt -pthread \
-  ../host/host.cxx ../include/HoughHelper.cxx  ../include/plotHelper.cxx -o host_openCL
+g++ --std=c++17 -I../include -I$XILINX_XRT/include -L$XILINX_XRT/lib -lOpenCL -lrt -pthread \
+  ../host/host.cxx ../include/HoughHelper.cxx ../include/HoughSimd.cxx  ../include/plotHelper.cxx ../include/EventFormat.cxx ../include/MergeParser.cxx ../include/EventStore.cxx ../include/ThreadPool.cxx ../include/EventBatch.cxx ../include/Backend.cxx ../include/Dispatcher.cxx ../include/DeviceProfile.cxx ../include/HoughEngine.cxx ../include/OpenCLBackend.cxx -o host_openCL
@@ -0,0 +1,6 @@
+v++ -c -t sw_emu --platform xilinx_u250_gen3x16_xdma_4_1_202210_1 --config ../kernel/u250_hough.cfg -k tkHough -I../src/ ../kernel/hough_kernel.cxx -o tkHough.xo
+
+if [ $? -eq 0 ];
+then
+    v++ -l -t sw_emu --platform xilinx_u250_gen3x16_xdma_4_1_202210_1 --config ../kernel/u250_hough.cfg ./tkHough.xo -o tkHough.xclbin
+fi